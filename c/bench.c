@@ -1,233 +1,2728 @@
-/*requires -lssl -lcrypto*/
+/*requires -lssl -lcrypto -lm (and -lrt -ldl before glibc 2.34)*/
+
+#define _GNU_SOURCE
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
 #include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <dirent.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <signal.h>
+#include <pthread.h>
+#include <dlfcn.h>
+#endif
 #include <openssl/sha.h>
+#include <openssl/evp.h>
+#if defined(_OPENMP) && defined(__has_include)
+#if __has_include(<omp-tools.h>)
+#define BENCH_HAS_OMPT
+#include <omp-tools.h>
+#endif
+#endif
 
+#undef BENCH_NO_REGIONS
 #include "bench.h"
 
 #define GG
 
+#ifndef BENCH_TPT
+#define BENCH_TPT (4096) /*Number of tasks per thread to be remembered*/
+#endif
+
+#ifndef BENCH_PROF_WORDS
+#define BENCH_PROF_WORDS (1 << 18) /*Per thread buffer of the sampling profiler*/
+#endif
+
+#define BENCH_CACHE_LINE (64)
+#define BENCH_COUNTERS (5)
+#define BENCH_PROF_DEPTH (64)
+#define BENCH_DOMAINS (16)
+#define BENCH_CALIBRATION (256) /*Empty tasks timed to find the probe overhead*/
+#define BENCH_METRICS (16) /*Names of process_add_metric and of task_add_count, each*/
+#define BENCH_PHASES (5)
+#define BENCH_FREQ_EVENTS (3) /*Cycles, task clock and ref-cycles, see freq_open_thread*/
+#define BENCH_THROTTLE_RATIO (0.9) /*A thread below this fraction of the base clock is throttled*/
+
+
+
+
+void * pmalloc(size_t size) {
+    void * q = malloc(size);
+    if(q == NULL) exit(EXIT_FAILURE);
+    return q;
+}
+
+/*
+ * Clock layer. Ticks come from a fenced rdtscp when the TSC is invariant
+ * and from CLOCK_MONOTONIC_RAW otherwise, BENCH_CLOCK=tsc|monotonic_raw|
+ * monotonic overrides the choice. For the clock_gettime sources a tick
+ * is a nanosecond, for the TSC the rate is calibrated at startup.
+ */
+enum Clock_source {
+    CLK_TSC = 0,
+    CLK_MONOTONIC_RAW,
+    CLK_MONOTONIC
+};
+
+static const char * clk_names[] = {"tsc", "monotonic_raw", "monotonic"};
+static unsigned long long phase_begin; /*Start of PHASE_STARTUP, after calibration*/
+static enum Clock_source clk_source = CLK_MONOTONIC_RAW;
+static double clk_per_ns = 1.0;
+static int clk_invariant;
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BENCH_HAS_TSC
+#include <cpuid.h>
+#endif
+
+static unsigned long long clk_ns(clockid_t id) {
+    struct timespec t;
+    clock_gettime(id, &t);
+    return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static unsigned long long clk_timing(void) {
+    #ifdef BENCH_HAS_TSC
+    if(clk_source == CLK_TSC) {
+        unsigned int lo, hi, aux;
+        /*rdtscp waits for older instructions, lfence holds younger ones*/
+        asm volatile("rdtscp" : "=a"(lo), "=d"(hi), "=c"(aux));
+        asm volatile("lfence" ::: "memory");
+        return ((unsigned long long) hi << 32) | lo;
+    }
+    #endif
+    return clk_ns(clk_source == CLK_MONOTONIC ? CLOCK_MONOTONIC : CLOCK_MONOTONIC_RAW);
+}
+
+static void live_init(void);
+static void tasks_clear(void);
+
+static double rtclock()
+{
+    return clk_timing() / clk_per_ns * 1e-9;
+}
+
+__attribute__((constructor)) static void clk_init(void) {
+    char * e = getenv("BENCH_CLOCK");
+    #ifdef BENCH_HAS_TSC
+    unsigned int a, b, c, d;
+    if(__get_cpuid(0x80000007, &a, &b, &c, &d))
+        clk_invariant = (d >> 8) & 1;
+    clk_source = clk_invariant ? CLK_TSC : CLK_MONOTONIC_RAW;
+    #endif
+    if(e != NULL) {
+        for(int i = 0; i < 3; i++)
+            if(strcmp(e, clk_names[i]) == 0) clk_source = i;
+    }
+    #ifndef BENCH_HAS_TSC
+    if(clk_source == CLK_TSC) clk_source = CLK_MONOTONIC_RAW;
+    #else
+    if(clk_source == CLK_TSC) {
+        /*About 20ms against CLOCK_MONOTONIC_RAW*/
+        unsigned long long t0, t1, c0, c1;
+        t0 = clk_ns(CLOCK_MONOTONIC_RAW);
+        c0 = clk_timing();
+        do {
+            t1 = clk_ns(CLOCK_MONOTONIC_RAW);
+        } while(t1 - t0 < 20000000ULL);
+        c1 = clk_timing();
+        clk_per_ns = (double) (c1 - c0) / (double) (t1 - t0);
+    }
+    #endif
+    phase_begin = clk_timing();
+    live_init();
+}
+
+/*
+ * Live counters. When BENCH_LIVE names a POSIX shared memory segment
+ * (bench run sets it) the library creates it at load time and keeps it
+ * current: the header below, then one slot per thread that registered,
+ * bumped at every task_stop_measure. Fields are native 64 bit words so
+ * a monitor on the same machine reads them as they are written. The
+ * segment is unlinked when the program exits.
+ */
+#define BENCH_LIVE_THREADS (256)
+
+struct live_header {
+    char magic[8]; /*"BNCHLIV1"*/
+    unsigned long long pid;
+    double ticks_per_ns;
+    unsigned long long start; /*Tick the library was loaded at*/
+    unsigned long long phase; /*Bench_phase, BENCH_PHASES when none*/
+    unsigned long long expected; /*Tasks a run completes, 0 if unknown*/
+    unsigned long long runs; /*Kernel calls process_repeat plans, 1 otherwise*/
+    unsigned long long runs_done;
+    unsigned long long threads; /*Slots handed out*/
+    unsigned long long reserved[7];
+};
+
+struct live_slot {
+    unsigned long long tasks;
+    unsigned long long busy; /*Ticks inside tasks*/
+    unsigned long long last; /*Tick the last task ended*/
+} __attribute__((aligned(BENCH_CACHE_LINE)));
+
+static struct live_header * live;
+static struct live_slot * live_slots;
+static char * live_name;
+static __thread struct live_slot * live_slot;
+
+static void live_unlink(void) {
+    shm_unlink(live_name);
+}
+
+static void live_init(void) {
+    size_t size = sizeof(struct live_header) + sizeof(struct live_slot) * BENCH_LIVE_THREADS;
+    void * p;
+    int fd;
+    if((live_name = getenv("BENCH_LIVE")) == NULL) return;
+    if((fd = shm_open(live_name, O_CREAT | O_RDWR, 0600)) < 0) return;
+    if(ftruncate(fd, size) != 0 || (p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        close(fd);
+        shm_unlink(live_name);
+        return;
+    }
+    close(fd);
+    memset(p, 0, size);
+    live = p;
+    live_slots = (struct live_slot *) (live + 1);
+    live->pid = getpid();
+    live->ticks_per_ns = clk_per_ns;
+    live->start = phase_begin;
+    live->phase = BENCH_PHASES;
+    live->runs = 1;
+    __sync_synchronize();
+    memcpy(live->magic, "BNCHLIV1", 8);
+    atexit(live_unlink);
+}
+
+/*Slot of the calling thread, threads past BENCH_LIVE_THREADS aren't shown*/
+static void live_claim(void) {
+    unsigned long long i;
+    if(live == NULL || live_slot != NULL) return;
+    if((i = __sync_fetch_and_add(&live->threads, 1)) < BENCH_LIVE_THREADS)
+        live_slot = &live_slots[i];
+}
+
+int process_progress_total(unsigned long long tasks) {
+    if(live != NULL) live->expected = tasks;
+    return 1;
+}
+
+/*
+ * The output is digested as it is appended, only the DEBUG build keeps
+ * a copy of it. Parts are the leaves of a tree hash, each one may be fed
+ * by a different thread.
+ */
+struct result_part {
+    EVP_MD_CTX * ctx;
+    unsigned long long size;
+} __attribute__((aligned(BENCH_CACHE_LINE)));
+
+/*Allocation traffic, only tracked in -DBENCH_ALLOC builds*/
+struct alloc_count {
+    unsigned long long count;
+    unsigned long long frees;
+    unsigned long long bytes;
+    unsigned long long ticks;
+};
+
+/*Figure of merit given by the program, see process_add_metric*/
+struct bench_metric {
+    const char * name;
+    const char * unit;
+    double value;
+};
+
+/*
+ * Resource usage of the whole process inside the measured region(s),
+ * summed over the samples, and its memory footprint at the end.
+ */
+struct bench_usage {
+    int taken;
+    long minor_faults, major_faults;
+    long voluntary_cs, involuntary_cs;
+    double user_time, system_time;
+    long rss_kb, peak_rss_kb;
+};
+
+/*
+ * Everything a run reports. The process_*, task_* and region calls work
+ * on the current context, a default one unless bench_ctx_use picked
+ * another. Threads get a recorder per context they time tasks in.
+ */
+struct bench_ctx {
+    int id; /*Never reused, 0 is the default context*/
+    char * name;
+    enum Bench_mode mode;
+    char * args;
+    double begin;
+    double end;
+    #ifdef DEBUG
+    char * out;
+    int out_size;
+    int out_max;
+    #endif
+    EVP_MD_CTX * out_ctx;
+    unsigned long long out_total;
+    struct result_part * parts;
+    int parts_size;
+    double * samples; /*Seconds, one per process_stop_measure*/
+    int samples_size;
+    int samples_max;
+    double verify_time; /*Seconds spent digesting files*/
+    double verify_measured; /*Part of it inside the measured region*/
+    int measuring;
+    struct task_recorder * recorders; /*Every recorder registered in it*/
+    int recorders_size;
+    struct alloc_count alloc_orphan;
+    struct alloc_count alloc_measured; /*Registered threads, inside the measured region*/
+    char * trace_path; /*Binary task trace, see trace_dump*/
+    char * timeline_path; /*Chrome trace, see timeline_dump*/
+    char * profile_path; /*Collapsed stacks, see profile_dump*/
+    char * env_paths[3]; /*Owned, built by env_path*/
+    unsigned long long begin_ticks; /*Tick of process_start_measure*/
+    unsigned long long perf_total[BENCH_COUNTERS];
+    struct rusage usage_start;
+    struct bench_usage usage;
+    unsigned long long energy_start[BENCH_DOMAINS]; /*Microjoules at process_start_measure*/
+    double energy[BENCH_DOMAINS]; /*Joules, summed over the samples*/
+    double energy_time; /*Seconds between the readings*/
+    struct bench_metric metrics[BENCH_METRICS];
+    int metrics_size;
+    unsigned long long throttle_start[2]; /*Core and package throttle events at process_start_measure*/
+    unsigned long long throttle[2]; /*Summed over the samples*/
+    int throttle_known;
+    double mhz_min, mhz_max, mhz_sum; /*scaling_cur_freq of every cpu at each start and stop*/
+    int mhz_readings;
+    double phases[BENCH_PHASES]; /*Seconds, see process_phase*/
+    int phase; /*Running one, -1 when stopped*/
+    int phased; /*process_phase was called*/
+    unsigned long long phase_start;
+    struct bench_ctx * next; /*In creation order*/
+};
 
+static struct bench_ctx bench_default;
+static struct bench_ctx * bench = &bench_default; /*Current context*/
+static int bench_id; /*Its id, checked on every task*/
+static struct bench_ctx * contexts = &bench_default;
+static int contexts_next = 1;
+static int contexts_lock;
 
+static EVP_MD_CTX * digest_new(void) {
+    EVP_MD_CTX * ctx = EVP_MD_CTX_new();
+    if(ctx == NULL || !EVP_DigestInit_ex(ctx, EVP_sha256(), NULL))
+        exit(EXIT_FAILURE);
+    return ctx;
+}
 
 void process_init() {
-    bench_data.out = (char *) malloc(512);
-    bench_data.out_size = 0;
-    bench_data.out_max = 512;
+    #ifdef DEBUG
+    bench->out = (char *) malloc(512);
+    bench->out_size = 0;
+    bench->out_max = 512;
+    #endif
+    if(bench->out_ctx == NULL) bench->out_ctx = digest_new();
 }
 
 void process_append_result(char * str, int size) {
+    if(bench->out_ctx == NULL) bench->out_ctx = digest_new();
+    EVP_DigestUpdate(bench->out_ctx, str, size);
+    bench->out_total += size;
+    #ifdef DEBUG
     int s_size, n_size;
     s_size = size;
-    n_size = s_size + bench_data.out_size;
-    if(n_size >= bench_data.out_max) {
+    n_size = s_size + bench->out_size;
+    if(n_size >= bench->out_max) {
         do {
-            bench_data.out_max = bench_data.out_max*2;
-        } while(n_size >= bench_data.out_max);
-        bench_data.out = (char *) realloc(bench_data.out,   bench_data.out_max);
+            bench->out_max = bench->out_max*2;
+        } while(n_size >= bench->out_max);
+        bench->out = (char *) realloc(bench->out,   bench->out_max);
     }
-    memcpy(bench_data.out + bench_data.out_size, str, s_size);
-    bench_data.out_size = n_size;
+    memcpy(bench->out + bench->out_size, str, s_size);
+    bench->out_size = n_size;
+    #endif
 }
 
-void process_append_file(char * str) {
-    FILE * out_file = fopen(str, "rb");
-    char out_bytes[128];
-    int out_size;
-    out_size = fread(out_bytes, 1, 128, out_file);
-    while(out_size > 0) {
-        process_append_result(out_bytes, out_size);
-        out_size = fread(out_bytes, 1, 128, out_file);
+int process_result_parts(int n) {
+    if(bench->parts != NULL || n <= 0) return 0;
+    if(posix_memalign((void **) &bench->parts, BENCH_CACHE_LINE, sizeof(struct result_part) * n))
+        exit(EXIT_FAILURE);
+    memset(bench->parts, 0, sizeof(struct result_part) * n);
+    bench->parts_size = n;
+    return 1;
+}
+
+int process_append_part(int part, char * str, int size) {
+    if(bench->parts == NULL || part < 0 || part >= bench->parts_size || size < 0) return 0;
+    struct result_part * p = &bench->parts[part];
+    /*Created by the thread that owns the part*/
+    if(p->ctx == NULL) p->ctx = digest_new();
+    EVP_DigestUpdate(p->ctx, str, size);
+    p->size += size;
+    return 1;
+}
+
+/*Flat SHA256 of the output or, with parts, SHA256 of the leaf digests*/
+static void result_digest(unsigned char * d) {
+    unsigned char leaf[EVP_MAX_MD_SIZE];
+    if(bench->out_ctx == NULL) bench->out_ctx = digest_new();
+    if(bench->parts_size == 0) {
+        EVP_DigestFinal_ex(bench->out_ctx, d, NULL);
+    } else {
+        EVP_MD_CTX * root = digest_new();
+        if(bench->out_total > 0) {
+            EVP_DigestFinal_ex(bench->out_ctx, leaf, NULL);
+            EVP_DigestUpdate(root, leaf, SHA256_DIGEST_LENGTH);
+        }
+        for(int i = 0; i < bench->parts_size; i++) {
+            if(bench->parts[i].ctx == NULL) bench->parts[i].ctx = digest_new();
+            EVP_DigestFinal_ex(bench->parts[i].ctx, leaf, NULL);
+            EVP_DigestUpdate(root, leaf, SHA256_DIGEST_LENGTH);
+            EVP_MD_CTX_free(bench->parts[i].ctx);
+        }
+        EVP_DigestFinal_ex(root, d, NULL);
+        EVP_MD_CTX_free(root);
+        free(bench->parts);
+        bench->parts = NULL;
+        bench->parts_size = 0;
     }
-    fclose(out_file);
+    EVP_MD_CTX_free(bench->out_ctx);
+    bench->out_ctx = NULL;
+    bench->out_total = 0;
 }
 
-#ifdef _OPENMP
-#include <omp.h>
+#define BENCH_READ_CHUNK (1 << 20)
 
-#define BENCH_TPT (4096) /*Number of tasks per thread to be remembered*/
+static void append_fd(int fd, off_t size) {
+    if(size > 0) {
+        char * m = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(m != MAP_FAILED) {
+            madvise(m, size, MADV_SEQUENTIAL);
+            for(off_t o = 0; o < size; o += BENCH_READ_CHUNK)
+                process_append_result(m + o, size - o < BENCH_READ_CHUNK ? size - o : BENCH_READ_CHUNK);
+            munmap(m, size);
+            return;
+        }
+    }
+    /*Pipes, empty or unmappable files*/
+    char * buf;
+    ssize_t n;
+    if(posix_memalign((void **) &buf, 4096, BENCH_READ_CHUNK)) exit(EXIT_FAILURE);
+    while((n = read(fd, buf, BENCH_READ_CHUNK)) > 0)
+        process_append_result(buf, n);
+    free(buf);
+}
 
-static unsigned long long **pool;
-static int *ptr;
-static int *loop;
+void process_append_file(char * str) {
+    double t = rtclock();
+    struct stat st;
+    int fd = open(str, O_RDONLY);
+    if(fd < 0) return;
+    append_fd(fd, fstat(fd, &st) == 0 && S_ISREG(st.st_mode) ? st.st_size : 0);
+    close(fd);
+    t = rtclock() - t;
+    bench->verify_time += t;
+    if(bench->measuring) bench->verify_measured += t;
+}
 
-#endif
+/*Node of a thread's region tree, times are in ticks*/
+struct bench_region {
+    const char * name;
+    unsigned long long start;
+    unsigned long long inclusive;
+    unsigned long long nested; /*Part of inclusive spent in child regions*/
+    unsigned long long calls;
+    int threads;
+    int open; /*Threads it was still open on at dump time, merged trees only*/
+    struct alloc_count alloc;
+    struct bench_region * parent;
+    struct bench_region * child;
+    struct bench_region * sibling;
+};
 
-static int str_size(char * str) {
-    int i;
-    for(i = 0; str[i] != '\0'; i++) {
-        switch(str[i]) {
-            case '\b':
-            case '\\':
-            case '\f':
-            case '\n':
-            case '\r':
-            case '\t':
-            case '\"':
-                i++;
-        }
-    };
-    return i+1;
+/*
+ * Log-linear histogram of task sizes: values below 2^HIST_BITS have their
+ * own bucket, above that every power of two is split in 2^(HIST_BITS-1)
+ * buckets, so a bucket is at most 1/128 of its values wide.
+ */
+#define HIST_BITS (8)
+#define HIST_HALF (1 << (HIST_BITS - 1))
+#define HIST_SIZE ((66 - HIST_BITS) * HIST_HALF) /*hist_index(~0ULL) is the last one*/
+
+struct task_hist {
+    unsigned long long count;
+    unsigned long long min;
+    unsigned long long max;
+    double sum;
+    double sum_sq;
+    unsigned long long bucket[HIST_SIZE];
 };
 
-char * mode[] = {"SEQ", "OPENMP", "PTHREADS", "OPTMIZED", "CUDA", "OPENMP_TASK", "OMPSS", "OMPSS2"};
+static inline int hist_index(unsigned long long v) {
+    if(v < (1ULL << HIST_BITS)) return v;
+    int m = 63 - __builtin_clzll(v);
+    int t = v >> (m - HIST_BITS + 1);
+    return (m - HIST_BITS + 2) * HIST_HALF + t - HIST_HALF;
+}
 
-static double rtclock()
-{
-    struct timespec t;
-    clock_gettime(CLOCK_REALTIME,&t);
-    return t.tv_sec  + t.tv_nsec *1e-9;
+/*Middle of the bucket*/
+static unsigned long long hist_value(int i) {
+    if(i < (1 << HIST_BITS)) return i;
+    int shift = i / HIST_HALF - 1;
+    unsigned long long low = (unsigned long long) (HIST_HALF + i % HIST_HALF) << shift;
+    return low + ((1ULL << shift) >> 1);
 }
 
-static unsigned long long clk_timing(void) {
-	unsigned long lo, hi;
-	unsigned long long l, h;
-	asm("rdtsc" : "=a"(lo), "=d"(hi)); 
-	h = hi;
-	l = lo | (h << 32);
-	return l;
+static void hist_clear(struct task_hist * h) {
+    memset(h, 0, sizeof(struct task_hist));
+    h->min = ~0ULL;
 }
 
-void process_name(char * str) {
-    bench_data.name = str;
+static inline void hist_add(struct task_hist * h, unsigned long long v) {
+    h->bucket[hist_index(v)]++;
+    h->count++;
+    if(v < h->min) h->min = v;
+    if(v > h->max) h->max = v;
+    h->sum += v;
+    h->sum_sq += (double) v * v;
 }
 
-void process_mode(enum Bench_mode mode) {
-    bench_data.mode = mode;
+static void hist_merge(struct task_hist * dst, struct task_hist * src) {
+    for(int i = 0; i < HIST_SIZE; i++)
+        dst->bucket[i] += src->bucket[i];
+    dst->count += src->count;
+    if(src->min < dst->min) dst->min = src->min;
+    if(src->max > dst->max) dst->max = src->max;
+    dst->sum += src->sum;
+    dst->sum_sq += src->sum_sq;
 }
 
-int process_args(int argc, char **argv) {
-    int i = 0;
-    for(int s = 0; s < argc; s++)
-        i += str_size(argv[s]);
-    char * q = malloc(i);
-    if(q == NULL) return 0;
-    i = 0;
-    for(int s = 0; s < argc; s++) {
-        for(int j = 0; argv[s][j] != '\0'; j++) {
-            switch(argv[s][j]) {
-            case '\b':
-                q[i++] = '\\';
-                q[i++] = 'b';
-                break;
-            case '\\':
-                q[i++] = '\\';
-                q[i++] = '\\';
-                break;
-            case '\f':
-                q[i++] = '\\';
-                q[i++] = 'f';
-                break;
-            case '\n':
-                q[i++] = '\\';
-                q[i++] = 'n';
-                break;
-            case '\r':
-                q[i++] = '\\';
-                q[i++] = 'r';
-                break;
-            case '\t':
-                q[i++] = '\\';
-                q[i++] = 't';
-                break;
-            case '\"':
-                q[i++] = '\\';
-                q[i++] = '"';
-                break;
-            default:
-                q[i++] = argv[s][j];
-            }
+static unsigned long long hist_percentile(struct task_hist * h, double p) {
+    unsigned long long rank = (unsigned long long) (p * h->count + 0.5), seen = 0;
+    if(rank < 1) rank = 1;
+    for(int i = 0; i < HIST_SIZE; i++) {
+        seen += h->bucket[i];
+        if(seen >= rank) {
+            unsigned long long v = hist_value(i);
+            return v < h->min ? h->min : v > h->max ? h->max : v;
         }
-        q[i++] = ' ';
     }
-    q[--i] = '\0';
-    bench_data.args = q;
-    return 1;
+    return h->max;
 }
 
-int process_start_measure(void) {
-    bench_data.begin = rtclock();
-    return 1;
+/*One task, times in ticks*/
+struct task_sample {
+    unsigned long long start;
+    unsigned long long size;
+    long long tag; /*Given by the caller, -1 if none*/
+    long long cpu; /*Where the task started*/
+};
+
+/*Per thread counter of task_add_count*/
+struct task_count {
+    const char * name;
+    unsigned long long value;
+};
+
+/*
+ * Each thread records its tasks in its own cache aligned block, so the
+ * hot path never writes to a line shared with another thread.
+ */
+struct task_recorder {
+    unsigned long long start;
+    long long tag;
+    long long cpu;
+    int ptr;
+    int loop;
+    int tid;
+    int owner; /*thread_serial of its thread*/
+    struct task_recorder * next;
+    struct bench_region region_root;
+    struct bench_region * region_cur;
+    int perf_fd; /*Leader of the thread's counter group, -1 if none*/
+    int perf_group[BENCH_COUNTERS];
+    unsigned long long perf_start[BENCH_COUNTERS];
+    unsigned long long perf_base[BENCH_COUNTERS]; /*Values at process_start_measure*/
+    unsigned long long perf_tasks[BENCH_COUNTERS]; /*Sum over the thread's tasks*/
+    int perf_scaled; /*A read of its groups was multiplexed, see group_read*/
+    int freq_fd; /*Leader of the thread's clock group, -1 if none*/
+    int freq_size;
+    int freq_group[BENCH_FREQ_EVENTS];
+    unsigned long long freq_base[BENCH_FREQ_EVENTS]; /*Values at process_start_measure*/
+    unsigned long long freq[BENCH_FREQ_EVENTS]; /*Summed over the samples*/
+    struct alloc_count alloc;
+    struct alloc_count alloc_base; /*Value at process_start_measure*/
+    unsigned long long * prof; /*Samples as (depth, ip, return addresses...)*/
+    int prof_used;
+    unsigned long long prof_samples;
+    unsigned long long prof_dropped;
+    unsigned long long busy; /*Ticks inside tasks since task_init_measure*/
+    unsigned long long busy_base, tasks_base; /*busy and task count at process_start_measure*/
+    unsigned long long last_end; /*Tick its last task ended*/
+    unsigned long long overhead; /*Ticks an empty task measures, see task_calibrate*/
+    struct task_count counts[BENCH_METRICS];
+    int counts_size;
+    struct task_hist hist; /*Every task, the pool only keeps the last ones*/
+    struct task_sample pool[BENCH_TPT];
+} __attribute__((aligned(BENCH_CACHE_LINE)));
+
+static __thread struct task_recorder * recorder;
+static __thread int recorder_id; /*Context it belongs to*/
+static int thread_serials;
+/*From 1 on the first registration, TLS addresses are reused by later threads but this is not*/
+static __thread int thread_serial;
+
+static void alloc_add(struct alloc_count * d, struct alloc_count * s) {
+    d->count += s->count;
+    d->frees += s->frees;
+    d->bytes += s->bytes;
+    d->ticks += s->ticks;
 }
 
-int process_stop_measure(void) {
-    bench_data.end = rtclock();
-    return 1;
+#ifdef BENCH_ALLOC
+
+/*
+ * Linking a bench.c built with -DBENCH_ALLOC replaces the allocator
+ * entry points of the whole program. Each call is forwarded to glibc
+ * and charged to the calling thread and its current region, or to
+ * the context's alloc_orphan for threads that never registered in it.
+ */
+extern void * __libc_malloc(size_t size);
+extern void * __libc_calloc(size_t n, size_t size);
+extern void * __libc_realloc(void * p, size_t size);
+extern void * __libc_memalign(size_t align, size_t size);
+extern void __libc_free(void * p);
+
+static void alloc_account(unsigned long long t0, size_t size, int freed) {
+    unsigned long long t = clk_timing() - t0;
+    struct task_recorder * r = recorder;
+    if(r == NULL || recorder_id != bench_id) {
+        __sync_fetch_and_add(freed ? &bench->alloc_orphan.frees : &bench->alloc_orphan.count, 1);
+        __sync_fetch_and_add(&bench->alloc_orphan.bytes, size);
+        __sync_fetch_and_add(&bench->alloc_orphan.ticks, t);
+        return;
+    }
+    struct alloc_count * c[2] = {&r->alloc, &r->region_cur->alloc};
+    for(int i = 0; i < 2; i++) {
+        if(freed) c[i]->frees++;
+        else c[i]->count++;
+        c[i]->bytes += size;
+        c[i]->ticks += t;
+    }
 }
 
-int dump_csv(FILE * f) {
-    fprintf(f, "{\"bench\" : \"%s\", \"id\" : \"\",\"mode\" : \"%s\",\"args\" : \"%s\",\"time\" : %lf", bench_data.name, mode[bench_data.mode], bench_data.args, bench_data.end - bench_data.begin);
-    
-    #ifdef _OPENMP
-    fprintf(f, ", \"tasks\" : [");
-    int q = omp_get_num_threads();
-    for(int i = 0; i < q; i++) {
-        if(loop[i]) {
-            for(int j = 0; j < BENCH_TPT; j++) {
-                printf("%llu,", pool[i][j]);
-            }
-        } else {
-            for(int j = 0; j < ptr[i]; j++) {
-                printf("%llu,", pool[i][j]);
-            }
-        }
+void * malloc(size_t size) {
+    unsigned long long t = clk_timing();
+    void * p = __libc_malloc(size);
+    alloc_account(t, size, 0);
+    return p;
+}
+
+void * calloc(size_t n, size_t size) {
+    unsigned long long t = clk_timing();
+    void * p = __libc_calloc(n, size);
+    alloc_account(t, n * size, 0);
+    return p;
+}
+
+void * realloc(void * q, size_t size) {
+    unsigned long long t = clk_timing();
+    void * p = __libc_realloc(q, size);
+    alloc_account(t, size, 0);
+    return p;
+}
+
+void * memalign(size_t align, size_t size) {
+    unsigned long long t = clk_timing();
+    void * p = __libc_memalign(align, size);
+    alloc_account(t, size, 0);
+    return p;
+}
+
+void * aligned_alloc(size_t align, size_t size) {
+    return memalign(align, size);
+}
+
+int posix_memalign(void ** p, size_t align, size_t size) {
+    if(align % sizeof(void *) != 0 || (align & (align - 1)) != 0) return EINVAL;
+    *p = memalign(align, size);
+    return *p == NULL ? ENOMEM : 0;
+}
+
+void free(void * p) {
+    if(p == NULL) return;
+    unsigned long long t = clk_timing();
+    __libc_free(p);
+    alloc_account(t, 0, 1);
+}
+
+static void alloc_snapshot(struct alloc_count * sum, int base) {
+    memset(sum, 0, sizeof(struct alloc_count));
+    for(struct task_recorder * r = bench->recorders; r != NULL; r = r->next) {
+        if(base) r->alloc_base = r->alloc;
+        alloc_add(sum, &r->alloc);
+        sum->count -= r->alloc_base.count;
+        sum->frees -= r->alloc_base.frees;
+        sum->bytes -= r->alloc_base.bytes;
+        sum->ticks -= r->alloc_base.ticks;
     }
-    fprintf(f,"0 ]");
-    #else
-    fprintf(f, ", \"tasks\" : \"not available\"");
-    #endif
+}
 
-    #ifdef DEBUG
-    puts(bench_data.out);
-    #endif
+#endif
 
-    fprintf(f, ",\"output\" : \"");
-	char *d = SHA256(bench_data.out, bench_data.out_size, 0);
-	for(int i = 0; i < SHA256_DIGEST_LENGTH; i++)
-		fprintf(f, "%02hhx", d[i]);
-    fprintf(f, "\"");
-    
-    fprintf(f, "}\n");
-    return 1;
+/*
+ * Hardware counters, enabled with BENCH_PERF=1. Every registered thread
+ * opens one group through perf_event_open, process values are the sum
+ * of the groups and task values the sum of the deltas around each task.
+ */
+static int perf_enabled = -1;
+static int perf_size; /*Counters of the group, a prefix of perf_names*/
+static const char * perf_names[BENCH_COUNTERS] = {"cycles", "instructions", "llc_misses", "branch_misses", "stalled_cycles"};
+
+static int perf_on(void) {
+    if(perf_enabled < 0) {
+        char * e = getenv("BENCH_PERF");
+        perf_enabled = e != NULL && strcmp(e, "0") != 0;
+    }
+    return perf_enabled;
 }
 
-#ifdef _OPENMP
+/*Scaled reads are estimates and may step back a little*/
+static unsigned long long counter_delta(unsigned long long now, unsigned long long then) {
+    return now > then ? now - then : 0;
+}
 
-void * pmalloc(size_t size) {
-    void * q = malloc(size);
-    if(q == NULL) exit(EXIT_FAILURE);
-    return q;
+#ifdef __linux__
+
+static const unsigned long long perf_config[BENCH_COUNTERS] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_MISSES,
+    PERF_COUNT_HW_STALLED_CYCLES_BACKEND
+};
+
+static int perf_open(unsigned int type, unsigned long long config, int group) {
+    struct perf_event_attr a;
+    memset(&a, 0, sizeof(a));
+    a.size = sizeof(a);
+    a.type = type;
+    a.config = config;
+    a.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    a.exclude_kernel = 1;
+    a.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &a, 0, -1, group, 0);
 }
 
-int task_init_measure(void) {
-    int q = omp_get_num_threads();
-   
-    pool = pmalloc(sizeof(int *) * q);
-    ptr = pmalloc(sizeof(int) * q);
-    loop = pmalloc(sizeof(int) * q);
-    for(int i = 0; i < q; i++) {
-        pool[i] = pmalloc(sizeof(unsigned long long) * BENCH_TPT);
-        ptr[i] = 0;
-        loop[i] = 0;
+/*
+ * The first thread decides how many counters the group has, a counter
+ * the machine lacks (usually stalled cycles) ends the group there.
+ */
+static void perf_open_thread(struct task_recorder * r) {
+    int fd[BENCH_COUNTERS], n;
+    r->perf_fd = -1;
+    if(!perf_on()) return;
+    if((fd[0] = perf_open(PERF_TYPE_HARDWARE, perf_config[0], -1)) < 0) return;
+    for(n = 1; n < BENCH_COUNTERS && (perf_size == 0 || n < perf_size); n++) {
+        if((fd[n] = perf_open(PERF_TYPE_HARDWARE, perf_config[n], fd[0])) < 0) break;
+    }
+    __sync_bool_compare_and_swap(&perf_size, 0, n);
+    if(n < perf_size) {
+        while(n > 0) close(fd[--n]);
+        return;
     }
+    memcpy(r->perf_group, fd, sizeof(int) * n);
+    r->perf_fd = fd[0];
 }
 
-int task_stop_measure(void) {
-    int q = omp_get_thread_num();
-    pool[q][ptr[q]] = clk_timing() - pool[q][ptr[q]];
-    ptr[q]++;
-    if(ptr[q] >= BENCH_TPT) {
-        ptr[q] = 0;
-        loop[q] = 1;
+/*
+ * A second group gives the clock a thread ran at: cycles against
+ * ref-cycles, which tick at the base clock, or against the task clock
+ * where ref-cycles are missing (most AMD and virtual machines).
+ */
+static void freq_open_thread(struct task_recorder * r) {
+    static const unsigned int type[BENCH_FREQ_EVENTS] = {PERF_TYPE_HARDWARE, PERF_TYPE_SOFTWARE, PERF_TYPE_HARDWARE};
+    static const unsigned long long config[BENCH_FREQ_EVENTS] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_SW_TASK_CLOCK,
+        PERF_COUNT_HW_REF_CPU_CYCLES
+    };
+    int n;
+    r->freq_fd = -1;
+    r->freq_size = 0;
+    if(!perf_on()) return;
+    if((r->freq_group[0] = perf_open(type[0], config[0], -1)) < 0) return;
+    for(n = 1; n < BENCH_FREQ_EVENTS; n++)
+        if((r->freq_group[n] = perf_open(type[n], config[n], r->freq_group[0])) < 0) break;
+    if(n < 2) {
+        close(r->freq_group[0]);
+        return;
     }
+    r->freq_fd = r->freq_group[0];
+    r->freq_size = n;
 }
 
-int task_start_measure(void) {
-    int q = omp_get_thread_num();
-    pool[q][ptr[q]] = clk_timing();
+static void perf_close_thread(struct task_recorder * r) {
+    for(int i = 0; i < r->freq_size; i++)
+        close(r->freq_group[i]);
+    r->freq_fd = -1;
+    r->freq_size = 0;
+    if(r->perf_fd < 0) return;
+    for(int i = 0; i < perf_size; i++)
+        close(r->perf_group[i]);
+    r->perf_fd = -1;
+}
+
+/*
+ * A group read is (nr, time enabled, time running, values). When the
+ * kernel multiplexed the group, running is below enabled and the values
+ * are scaled up by enabled/running, an estimate the dump flags.
+ */
+static int group_read(struct task_recorder * r, int fd, int n, unsigned long long * v) {
+    unsigned long long buf[3 + BENCH_COUNTERS];
+    if(fd < 0 || read(fd, buf, sizeof(buf)) <= 0 || buf[2] == 0) return 0;
+    if(buf[2] >= buf[1]) {
+        memcpy(v, buf + 3, sizeof(unsigned long long) * n);
+        return 1;
+    }
+    for(int i = 0; i < n; i++)
+        v[i] = (unsigned long long) ((double) buf[3 + i] * buf[1] / buf[2]);
+    r->perf_scaled = 1;
+    return 1;
+}
+
+static int perf_read(struct task_recorder * r, unsigned long long * v) {
+    return group_read(r, r->perf_fd, perf_size, v);
+}
+
+static int freq_read(struct task_recorder * r, unsigned long long * v) {
+    return group_read(r, r->freq_fd, r->freq_size, v);
+}
+
+#else
+
+static void perf_open_thread(struct task_recorder * r) {
+    r->perf_fd = -1;
+}
+
+static void freq_open_thread(struct task_recorder * r) {
+    r->freq_fd = -1;
+    r->freq_size = 0;
+}
+
+static void perf_close_thread(struct task_recorder * r) {
+}
+
+static int perf_read(struct task_recorder * r, unsigned long long * v) {
+    return 0;
 }
 
+static int freq_read(struct task_recorder * r, unsigned long long * v) {
+    return 0;
+}
+
+#endif
+
+/*
+ * Sampling profiler, enabled by process_profile(path) or BENCH_PROFILE.
+ * Every registered thread arms a CPU time timer that sends it SIGPROF
+ * BENCH_PROFILE_HZ times a second (997 by default). While a run is
+ * measured the handler appends the interrupted instruction pointer and,
+ * with BENCH_PROFILE_DEPTH=n, up to n-1 return addresses found through
+ * the frame pointers, to the thread's own buffer. Nothing is shared, so
+ * no lock is taken; a full buffer only counts what it drops. The timer
+ * is deleted when its thread exits. Threads that registered before the
+ * profiler was enabled have no buffer and are not sampled, except the
+ * one calling process_profile.
+ */
+static int prof_enabled = -1;
+static int prof_hz;
+static int prof_depth;
+static __thread int prof_armed;
+static __thread unsigned long long prof_lo, prof_hi; /*Stack of the thread*/
+static __thread timer_t prof_timer;
+static pthread_key_t prof_key; /*Its destructor deletes the timer of an exiting thread*/
+
+#if defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__))
+#define BENCH_HAS_PROF
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
 #endif
+
+static void prof_handler(int sig, siginfo_t * si, void * context) {
+    struct task_recorder * r = recorder;
+    if(r == NULL || recorder_id != bench_id || r->prof == NULL || !bench->measuring) return;
+    if(r->prof_used + 1 + prof_depth > BENCH_PROF_WORDS) {
+        r->prof_dropped++;
+        return;
+    }
+    mcontext_t * m = &((ucontext_t *) context)->uc_mcontext;
+    unsigned long long * p = r->prof + r->prof_used;
+    #ifdef __x86_64__
+    unsigned long long fp = m->gregs[REG_RBP];
+    p[1] = m->gregs[REG_RIP];
+    #else
+    unsigned long long fp = m->regs[29];
+    p[1] = m->pc;
+    #endif
+    int n = 1;
+    /*Only frames inside the thread's stack, code built without frame pointers stops the walk early*/
+    while(n < prof_depth && fp % 8 == 0 && fp >= prof_lo && fp + 16 <= prof_hi) {
+        unsigned long long * f = (unsigned long long *) fp;
+        if(f[1] == 0) break;
+        p[1 + n++] = f[1];
+        if(f[0] <= fp) break;
+        fp = f[0];
+    }
+    p[0] = n;
+    r->prof_used += 1 + n;
+    r->prof_samples++;
+}
+
+static int prof_on(void) {
+    if(prof_enabled < 0) {
+        char * e = getenv("BENCH_PROFILE_HZ");
+        prof_enabled = getenv("BENCH_PROFILE") != NULL;
+        prof_hz = e != NULL && atoi(e) > 0 ? atoi(e) : 997;
+        e = getenv("BENCH_PROFILE_DEPTH");
+        prof_depth = e != NULL && atoi(e) > 0 ? atoi(e) : 1;
+        if(prof_depth > BENCH_PROF_DEPTH) prof_depth = BENCH_PROF_DEPTH;
+    }
+    return prof_enabled;
+}
+
+static void prof_disarm(void * t) {
+    timer_delete(*(timer_t *) t);
+}
+
+/*Once per thread, the timer outlives the contexts*/
+static void prof_arm(void) {
+    static int installed;
+    pthread_attr_t a;
+    void * lo;
+    size_t size;
+    struct sigevent se;
+    struct itimerspec it;
+    if(prof_armed) return;
+    prof_armed = 1;
+    if(__sync_bool_compare_and_swap(&installed, 0, 1)) {
+        struct sigaction sa;
+        pthread_key_create(&prof_key, prof_disarm);
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_sigaction = prof_handler;
+        sa.sa_flags = SA_SIGINFO | SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGPROF, &sa, NULL);
+    }
+    if(pthread_getattr_np(pthread_self(), &a) == 0) {
+        if(pthread_attr_getstack(&a, &lo, &size) == 0) {
+            prof_lo = (unsigned long long) lo;
+            prof_hi = prof_lo + size;
+        }
+        pthread_attr_destroy(&a);
+    }
+    memset(&se, 0, sizeof(se));
+    se.sigev_notify = SIGEV_THREAD_ID;
+    se.sigev_signo = SIGPROF;
+    se.sigev_notify_thread_id = syscall(SYS_gettid);
+    if(timer_create(CLOCK_THREAD_CPUTIME_ID, &se, &prof_timer) != 0) return;
+    pthread_setspecific(prof_key, &prof_timer);
+    it.it_interval.tv_sec = 0;
+    it.it_interval.tv_nsec = 1000000000L / prof_hz;
+    it.it_value = it.it_interval;
+    timer_settime(prof_timer, 0, &it, NULL);
+}
+
+/*Symbol of an address, or module+offset when it has none (build with -rdynamic for names)*/
+static int prof_symbol(char * buf, size_t n, unsigned long long ip) {
+    Dl_info d;
+    if(dladdr((void *) ip, &d) == 0 || d.dli_fname == NULL)
+        return snprintf(buf, n, "0x%llx", ip);
+    if(d.dli_sname != NULL)
+        return snprintf(buf, n, "%s", d.dli_sname);
+    const char * base = strrchr(d.dli_fname, '/');
+    return snprintf(buf, n, "%s+0x%llx", base != NULL ? base + 1 : d.dli_fname,
+        ip - (unsigned long long) d.dli_fbase);
+}
+
+#else
+
+static int prof_on(void) {
+    prof_enabled = 0;
+    return 0;
+}
+
+static void prof_arm(void) {
+}
+
+static int prof_symbol(char * buf, size_t n, unsigned long long ip) {
+    return snprintf(buf, n, "0x%llx", ip);
+}
+
+#endif
+
+#if defined(BENCH_LOCKS) && defined(__linux__)
+
+/*
+ * Linking a bench.c built with -DBENCH_LOCKS replaces pthread_mutex_lock,
+ * pthread_mutex_unlock, pthread_cond_wait and pthread_barrier_wait of the
+ * whole program. Each call is forwarded to glibc and charged to its
+ * (lock, call site) pair: acquisitions, contended ones (the trylock
+ * found it busy), ticks spent waiting and, for mutexes, ticks held. Counts
+ * are process wide and cover the whole program, not only measured regions.
+ */
+#define BENCH_LOCK_SITES (1024)
+#define BENCH_LOCK_DEPTH (16) /*Mutexes a thread holds at once, deeper ones get no hold time*/
+#define BENCH_LOCK_TOP (10)
+
+/*Default versions of the symbols forwarded to, dlvsym falls back to dlsym*/
+#ifdef __aarch64__
+#define BENCH_COND_VERSION "GLIBC_2.17"
+#else
+#define BENCH_COND_VERSION "GLIBC_2.3.2"
+#endif
+#define BENCH_BARRIER_VERSION "GLIBC_2.34"
+
+enum Lock_kind {
+    LOCK_MUTEX = 0,
+    LOCK_COND,
+    LOCK_BARRIER
+};
+
+static const char * lock_kinds[] = {"mutex", "cond", "barrier"};
+
+struct lock_site {
+    const void * lock;
+    const void * site; /*Return address of the wrapped call*/
+    int kind;
+    volatile int ready;
+    unsigned long long count;
+    unsigned long long contended;
+    unsigned long long wait;
+    unsigned long long max_wait;
+    unsigned long long hold;
+};
+
+static struct lock_site lock_sites[BENCH_LOCK_SITES];
+static int lock_sites_size;
+static int lock_sites_lock;
+static unsigned long long lock_dropped; /*Calls that found the table full*/
+
+struct lock_held {
+    const pthread_mutex_t * mutex;
+    struct lock_site * s;
+    unsigned long long since;
+};
+
+static __thread struct lock_held lock_held[BENCH_LOCK_DEPTH];
+static __thread int lock_held_size;
+
+static int (*real_mutex_lock)(pthread_mutex_t *);
+static int (*real_mutex_unlock)(pthread_mutex_t *);
+static int (*real_cond_wait)(pthread_cond_t *, pthread_mutex_t *);
+static int (*real_barrier_wait)(pthread_barrier_t *);
+
+/*dlsym would give the pre 2.3.2 condition variables*/
+static void * lock_next(const char * name, const char * version) {
+    void * f = dlvsym(RTLD_NEXT, name, version);
+    return f != NULL ? f : dlsym(RTLD_NEXT, name);
+}
+
+/*Before any thread can be started, again if another constructor locks first*/
+__attribute__((constructor)) static void locks_init(void) {
+    real_mutex_lock = lock_next("pthread_mutex_lock", "GLIBC_2.2.5");
+    real_mutex_unlock = lock_next("pthread_mutex_unlock", "GLIBC_2.2.5");
+    real_cond_wait = lock_next("pthread_cond_wait", BENCH_COND_VERSION);
+    real_barrier_wait = lock_next("pthread_barrier_wait", BENCH_BARRIER_VERSION);
+}
+
+static struct lock_site * lock_find(const void * lock, const void * site, int kind) {
+    unsigned long long h = ((unsigned long long) lock >> 3) * 31 + ((unsigned long long) site >> 2);
+    for(int i = 0; i < BENCH_LOCK_SITES; i++) {
+        struct lock_site * s = &lock_sites[(h + i) & (BENCH_LOCK_SITES - 1)];
+        if(!s->ready) {
+            while(__sync_lock_test_and_set(&lock_sites_lock, 1))
+                ;
+            if(!s->ready) {
+                s->lock = lock;
+                s->site = site;
+                s->kind = kind;
+                lock_sites_size++;
+                __sync_synchronize();
+                s->ready = 1;
+            }
+            __sync_lock_release(&lock_sites_lock);
+        }
+        if(s->lock == lock && s->site == site) return s;
+    }
+    __sync_fetch_and_add(&lock_dropped, 1);
+    return NULL;
+}
+
+static void lock_waited(struct lock_site * s, unsigned long long wait, int contended) {
+    unsigned long long m;
+    if(s == NULL) return;
+    __sync_fetch_and_add(&s->count, 1);
+    if(!contended) return;
+    __sync_fetch_and_add(&s->contended, 1);
+    __sync_fetch_and_add(&s->wait, wait);
+    while((m = s->max_wait) < wait && !__sync_bool_compare_and_swap(&s->max_wait, m, wait))
+        ;
+}
+
+static void lock_acquired(const pthread_mutex_t * m, struct lock_site * s) {
+    if(lock_held_size == BENCH_LOCK_DEPTH) return;
+    lock_held[lock_held_size].mutex = m;
+    lock_held[lock_held_size].s = s;
+    lock_held[lock_held_size].since = clk_timing();
+    lock_held_size++;
+}
+
+/*Site of the acquisition m was released from, NULL if it wasn't tracked*/
+static struct lock_site * lock_released(const pthread_mutex_t * m) {
+    for(int i = lock_held_size - 1; i >= 0; i--) {
+        if(lock_held[i].mutex != m) continue;
+        struct lock_site * s = lock_held[i].s;
+        if(s != NULL) __sync_fetch_and_add(&s->hold, clk_timing() - lock_held[i].since);
+        lock_held[i] = lock_held[--lock_held_size];
+        return s;
+    }
+    return NULL;
+}
+
+int pthread_mutex_lock(pthread_mutex_t * m) {
+    struct lock_site * s = lock_find(m, __builtin_return_address(0), LOCK_MUTEX);
+    unsigned long long t = 0;
+    /*Only a busy mutex is waited for, EOWNERDEAD, EAGAIN, EINVAL... go back to the caller*/
+    int e = pthread_mutex_trylock(m), contended = e == EBUSY;
+    if(e != 0 && !contended && e != EOWNERDEAD) return e;
+    if(contended) {
+        t = clk_timing();
+        if(real_mutex_lock == NULL) locks_init();
+        e = real_mutex_lock(m);
+        t = clk_timing() - t;
+    }
+    /*A robust mutex whose owner died is acquired all the same, EDEADLK is not*/
+    if(e != 0 && e != EOWNERDEAD) return e;
+    lock_waited(s, t, contended);
+    lock_acquired(m, s);
+    return e;
+}
+
+int pthread_mutex_unlock(pthread_mutex_t * m) {
+    lock_released(m);
+    if(real_mutex_unlock == NULL) locks_init();
+    return real_mutex_unlock(m);
+}
+
+/*The wait is charged to the condition, the mutex stops being held meanwhile*/
+int pthread_cond_wait(pthread_cond_t * c, pthread_mutex_t * m) {
+    struct lock_site * s = lock_find(c, __builtin_return_address(0), LOCK_COND);
+    struct lock_site * held = lock_released(m);
+    if(real_cond_wait == NULL) locks_init();
+    unsigned long long t = clk_timing();
+    int e = real_cond_wait(c, m);
+    /*EOWNERDEAD waited and took the mutex back, EINVAL or EPERM left it as it was*/
+    if(e == 0 || e == EOWNERDEAD) {
+        lock_waited(s, clk_timing() - t, 1);
+        lock_acquired(m, held);
+    } else if(held != NULL) {
+        lock_acquired(m, held);
+    }
+    return e;
+}
+
+int pthread_barrier_wait(pthread_barrier_t * b) {
+    struct lock_site * s = lock_find(b, __builtin_return_address(0), LOCK_BARRIER);
+    if(real_barrier_wait == NULL) locks_init();
+    unsigned long long t = clk_timing();
+    int e = real_barrier_wait(b);
+    if(e == 0 || e == PTHREAD_BARRIER_SERIAL_THREAD) lock_waited(s, clk_timing() - t, 1);
+    return e;
+}
+
+/*Name of a lock or call site, function+offset with -rdynamic, else module+offset*/
+static void lock_symbol(char * buf, size_t n, const void * p) {
+    Dl_info d;
+    if(dladdr(p, &d) == 0 || d.dli_fname == NULL) {
+        snprintf(buf, n, "%p", p);
+    } else if(d.dli_sname != NULL && p == d.dli_saddr) {
+        snprintf(buf, n, "%s", d.dli_sname);
+    } else if(d.dli_sname != NULL) {
+        snprintf(buf, n, "%s+0x%lx", d.dli_sname, (unsigned long) ((const char *) p - (const char *) d.dli_saddr));
+    } else {
+        const char * base = strrchr(d.dli_fname, '/');
+        snprintf(buf, n, "%s+0x%lx", base != NULL ? base + 1 : d.dli_fname,
+            (unsigned long) ((const char *) p - (const char *) d.dli_fbase));
+    }
+    buf[strcspn(buf, "\"\\")] = '\0';
+}
+
+static int lock_cmp(const void * a, const void * b) {
+    const struct lock_site * x = *(struct lock_site * const *) a, * y = *(struct lock_site * const *) b;
+    return (x->wait < y->wait) - (x->wait > y->wait);
+}
+
+/*The BENCH_LOCK_TOP sites that waited longest*/
+static void locks_dump(FILE * f) {
+    struct lock_site * by_wait[BENCH_LOCK_SITES];
+    unsigned long long wait = 0, hold = 0;
+    char lock[256], site[256];
+    int n = 0;
+    for(int i = 0; i < BENCH_LOCK_SITES; i++) {
+        if(!lock_sites[i].ready) continue;
+        by_wait[n++] = &lock_sites[i];
+        wait += lock_sites[i].wait;
+        hold += lock_sites[i].hold;
+    }
+    qsort(by_wait, n, sizeof(struct lock_site *), lock_cmp);
+    fprintf(f, ", \"locks\" : {\"sites\" : %d,\"dropped\" : %llu,\"wait\" : %llu,\"hold\" : %llu,\"top\" : [",
+        n, lock_dropped, wait, hold);
+    for(int i = 0; i < n && i < BENCH_LOCK_TOP; i++) {
+        struct lock_site * s = by_wait[i];
+        lock_symbol(lock, sizeof(lock), s->lock);
+        lock_symbol(site, sizeof(site), s->site);
+        fprintf(f, "%s{\"lock\" : \"%s\",\"kind\" : \"%s\",\"site\" : \"%s\",\"count\" : %llu,\"contended\" : %llu,\"wait\" : %llu,\"max_wait\" : %llu,\"hold\" : %llu}",
+            i ? "," : "", lock, lock_kinds[s->kind], site, s->count, s->contended, s->wait, s->max_wait, s->hold);
+    }
+    fprintf(f, "]}");
+}
+
+#else
+
+static void locks_dump(FILE * f) {
+}
+
+#endif
+
+static int str_size(char * str) {
+    int i;
+    for(i = 0; str[i] != '\0'; i++) {
+        switch(str[i]) {
+            case '\b':
+            case '\\':
+            case '\f':
+            case '\n':
+            case '\r':
+            case '\t':
+            case '\"':
+                i++;
+        }
+    };
+    return i+1;
+};
+
+char * mode[] = {"SEQ", "OPENMP", "PTHREADS", "OPTMIZED", "CUDA", "OPENMP_TASK", "OMPSS", "OMPSS2"};
+
+void process_name(char * str) {
+    bench->name = str;
+}
+
+void process_mode(enum Bench_mode mode) {
+    bench->mode = mode;
+}
+
+int process_args(int argc, char **argv) {
+    int i = 0;
+    for(int s = 0; s < argc; s++)
+        i += str_size(argv[s]);
+    char * q = malloc(i + 1); /*argc may be 0*/
+    if(q == NULL) return 0;
+    i = 0;
+    for(int s = 0; s < argc; s++) {
+        for(int j = 0; argv[s][j] != '\0'; j++) {
+            switch(argv[s][j]) {
+            case '\b':
+                q[i++] = '\\';
+                q[i++] = 'b';
+                break;
+            case '\\':
+                q[i++] = '\\';
+                q[i++] = '\\';
+                break;
+            case '\f':
+                q[i++] = '\\';
+                q[i++] = 'f';
+                break;
+            case '\n':
+                q[i++] = '\\';
+                q[i++] = 'n';
+                break;
+            case '\r':
+                q[i++] = '\\';
+                q[i++] = 'r';
+                break;
+            case '\t':
+                q[i++] = '\\';
+                q[i++] = 't';
+                break;
+            case '\"':
+                q[i++] = '\\';
+                q[i++] = '"';
+                break;
+            default:
+                q[i++] = argv[s][j];
+            }
+        }
+        q[i++] = ' ';
+    }
+    q[i > 0 ? i - 1 : 0] = '\0';
+    bench->args = q;
+    return 1;
+}
+
+int process_repeat(int warmup, int runs, void (*kernel)(void *), void * arg) {
+    if(live != NULL) {
+        live->runs = warmup + runs;
+        live->runs_done = 0;
+    }
+    for(int i = 0; i < warmup; i++) {
+        kernel(arg);
+        if(live != NULL) live->runs_done++;
+    }
+    /*The warmup tasks are not part of the samples either*/
+    if(warmup > 0) tasks_clear();
+    bench->samples_size = 0;
+    for(int i = 0; i < runs; i++) {
+        process_start_measure();
+        kernel(arg);
+        process_stop_measure();
+        if(live != NULL) live->runs_done++;
+    }
+    return 1;
+}
+
+static const char * phase_names[] = {"startup", "load", "compute", "output", "verify"};
+
+/*Ends the running phase at t, the default context starts in PHASE_STARTUP*/
+static void phase_stop(unsigned long long t) {
+    if(bench->phase < 0) return;
+    unsigned long long start = bench->phase_start;
+    if(start == 0 && bench->id == 0) start = phase_begin;
+    bench->phases[bench->phase] += (t - start) / clk_per_ns * 1e-9;
+    bench->phase = -1;
+}
+
+int process_phase(enum Bench_phase phase) {
+    unsigned long long t = clk_timing();
+    if(phase < 0 || phase >= BENCH_PHASES) return 0;
+    phase_stop(t);
+    bench->phase = phase;
+    bench->phase_start = t;
+    if(live != NULL) live->phase = phase;
+    bench->phased = 1;
+    return 1;
+}
+
+int process_phase_end(void) {
+    phase_stop(clk_timing());
+    if(live != NULL) live->phase = BENCH_PHASES;
+    return 1;
+}
+
+static void phases_dump(FILE * f) {
+    if(!bench->phased) return;
+    phase_stop(clk_timing());
+    fprintf(f, ", \"phases\" : {");
+    for(int i = 0; i < BENCH_PHASES; i++)
+        fprintf(f, "%s\"%s\" : %lf", i ? "," : "", phase_names[i], bench->phases[i]);
+    fprintf(f, "}");
+}
+
+static double tv_sec(struct timeval t) {
+    return t.tv_sec + t.tv_usec * 1e-6;
+}
+
+/*Value of a "Key:  123 kB" line of /proc/self/status, -1 if absent*/
+static long status_kb(const char * key) {
+    char line[128];
+    long v = -1;
+    size_t n = strlen(key);
+    FILE * f = fopen("/proc/self/status", "r");
+    if(f == NULL) return -1;
+    while(fgets(line, sizeof(line), f) != NULL) {
+        if(strncmp(line, key, n) == 0 && line[n] == ':') {
+            v = strtol(line + n + 1, NULL, 10);
+            break;
+        }
+    }
+    fclose(f);
+    return v;
+}
+
+static void usage_stop(void) {
+    struct rusage u;
+    getrusage(RUSAGE_SELF, &u);
+    bench->usage.taken = 1;
+    bench->usage.minor_faults += u.ru_minflt - bench->usage_start.ru_minflt;
+    bench->usage.major_faults += u.ru_majflt - bench->usage_start.ru_majflt;
+    bench->usage.voluntary_cs += u.ru_nvcsw - bench->usage_start.ru_nvcsw;
+    bench->usage.involuntary_cs += u.ru_nivcsw - bench->usage_start.ru_nivcsw;
+    bench->usage.user_time += tv_sec(u.ru_utime) - tv_sec(bench->usage_start.ru_utime);
+    bench->usage.system_time += tv_sec(u.ru_stime) - tv_sec(bench->usage_start.ru_stime);
+    bench->usage.rss_kb = status_kb("VmRSS");
+    bench->usage.peak_rss_kb = status_kb("VmHWM");
+    if(bench->usage.peak_rss_kb < 0) bench->usage.peak_rss_kb = u.ru_maxrss; /*kB on Linux*/
+}
+
+/*
+ * Energy from the powercap RAPL zones, intel-rapl:<package> and their
+ * intel-rapl:<package>:<n> domains (core, uncore, dram), read around the
+ * measured region. BENCH_POWERCAP replaces /sys/class/powercap, e.g.
+ * with a fake tree. Zones whose energy_uj can't be read (root only on
+ * recent kernels) are left out.
+ */
+struct rapl_domain {
+    char name[128]; /*e.g. package-0 or package-0/dram*/
+    char * path; /*Its energy_uj*/
+    unsigned long long range; /*max_energy_range_uj, where the counter wraps*/
+};
+
+static struct rapl_domain rapl[BENCH_DOMAINS];
+static int rapl_size = -1;
+
+static int read_ull(const char * path, unsigned long long * v) {
+    FILE * f = fopen(path, "r");
+    if(f == NULL) return 0;
+    int ok = fscanf(f, "%llu", v) == 1;
+    fclose(f);
+    return ok;
+}
+
+static void zone_name(const char * root, const char * zone, char * buf, int n) {
+    char path[4096];
+    FILE * f;
+    snprintf(path, sizeof(path), "%s/%s/name", root, zone);
+    buf[0] = '\0';
+    if((f = fopen(path, "r")) != NULL) {
+        if(fgets(buf, n, f) == NULL) buf[0] = '\0';
+        fclose(f);
+    }
+    buf[strcspn(buf, "\n\"\\")] = '\0';
+    if(buf[0] == '\0') snprintf(buf, n, "%s", zone);
+}
+
+static int zone_cmp(const void * a, const void * b) {
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+static void rapl_init(void) {
+    char * root = getenv("BENCH_POWERCAP");
+    char path[4096], parent[64], name[64], * zones[BENCH_DOMAINS];
+    struct dirent * e;
+    int n = 0;
+    rapl_size = 0;
+    if(root == NULL) root = "/sys/class/powercap";
+    DIR * d = opendir(root);
+    if(d == NULL) return;
+    while((e = readdir(d)) != NULL && n < BENCH_DOMAINS)
+        if(strncmp(e->d_name, "intel-rapl:", 11) == 0) zones[n++] = strdup(e->d_name);
+    closedir(d);
+    /*Packages before their domains*/
+    qsort(zones, n, sizeof(char *), zone_cmp);
+    for(int i = 0; i < n; i++) {
+        struct rapl_domain * r = &rapl[rapl_size];
+        unsigned long long v;
+        snprintf(path, sizeof(path), "%s/%s/energy_uj", root, zones[i]);
+        if(read_ull(path, &v)) {
+            r->path = strdup(path);
+            snprintf(path, sizeof(path), "%s/%s/max_energy_range_uj", root, zones[i]);
+            if(!read_ull(path, &r->range)) r->range = 0;
+            zone_name(root, zones[i], name, sizeof(name));
+            char * sep = strchr(zones[i] + 11, ':');
+            if(sep != NULL) {
+                snprintf(path, sizeof(path), "%.*s", (int) (sep - zones[i]), zones[i]);
+                zone_name(root, path, parent, sizeof(parent));
+                snprintf(r->name, sizeof(r->name), "%s/%s", parent, name);
+            } else {
+                snprintf(r->name, sizeof(r->name), "%s", name);
+            }
+            rapl_size++;
+        }
+        free(zones[i]);
+    }
+}
+
+static void rapl_read(unsigned long long * v) {
+    if(rapl_size < 0) rapl_init();
+    for(int i = 0; i < rapl_size; i++)
+        if(!read_ull(rapl[i].path, &v[i])) v[i] = 0;
+}
+
+static void rapl_stop(double seconds) {
+    unsigned long long v[BENCH_DOMAINS];
+    rapl_read(v);
+    for(int i = 0; i < rapl_size; i++) {
+        unsigned long long s = bench->energy_start[i];
+        /*Wrapped at most once, the range covers minutes even at full power*/
+        unsigned long long d = v[i] >= s ? v[i] - s : v[i] + rapl[i].range - s;
+        bench->energy[i] += d * 1e-6;
+    }
+    bench->energy_time += seconds;
+}
+
+/*
+ * Clock and thermal state of the cpus, from the cpufreq and
+ * thermal_throttle files of /sys/devices/system/cpu (or of the tree
+ * BENCH_CPU_SYSFS points to), read at every start and stop. Throttle
+ * counters only exist on Intel, cpufreq not at all in most VMs.
+ */
+static char ** cpu_dirs;
+static int cpu_size = -1;
+static double cpu_base_khz; /*base_frequency of the first cpu, 0 if unknown*/
+
+static void cpus_init(void) {
+    char * root = getenv("BENCH_CPU_SYSFS");
+    char path[4096];
+    struct dirent * e;
+    unsigned long long v;
+    int max = 0;
+    cpu_size = 0;
+    if(root == NULL) root = "/sys/devices/system/cpu";
+    DIR * d = opendir(root);
+    if(d == NULL) return;
+    while((e = readdir(d)) != NULL) {
+        if(strncmp(e->d_name, "cpu", 3) != 0 || e->d_name[3] < '0' || e->d_name[3] > '9') continue;
+        if(cpu_size == max) {
+            max = max ? max * 2 : 64;
+            cpu_dirs = realloc(cpu_dirs, sizeof(char *) * max);
+            if(cpu_dirs == NULL) exit(EXIT_FAILURE);
+        }
+        snprintf(path, sizeof(path), "%s/%s", root, e->d_name);
+        cpu_dirs[cpu_size++] = strdup(path);
+    }
+    closedir(d);
+    qsort(cpu_dirs, cpu_size, sizeof(char *), zone_cmp);
+    if(cpu_size > 0) {
+        snprintf(path, sizeof(path), "%s/cpufreq/base_frequency", cpu_dirs[0]);
+        if(read_ull(path, &v)) cpu_base_khz = v;
+    }
+}
+
+/*Throttle events so far into t, current clocks into the context's MHz figures*/
+static void cpus_read(unsigned long long * t) {
+    static const char * throttle_files[2] = {"core_throttle_count", "package_throttle_count"};
+    char path[4096];
+    unsigned long long v;
+    if(cpu_size < 0) cpus_init();
+    t[0] = t[1] = 0;
+    for(int i = 0; i < cpu_size; i++) {
+        for(int j = 0; j < 2; j++) {
+            snprintf(path, sizeof(path), "%s/thermal_throttle/%s", cpu_dirs[i], throttle_files[j]);
+            if(read_ull(path, &v)) {
+                t[j] += v;
+                bench->throttle_known = 1;
+            }
+        }
+        snprintf(path, sizeof(path), "%s/cpufreq/scaling_cur_freq", cpu_dirs[i]);
+        if(read_ull(path, &v)) {
+            double mhz = v * 1e-3;
+            if(bench->mhz_readings == 0 || mhz < bench->mhz_min) bench->mhz_min = mhz;
+            if(bench->mhz_readings == 0 || mhz > bench->mhz_max) bench->mhz_max = mhz;
+            bench->mhz_sum += mhz;
+            bench->mhz_readings++;
+        }
+    }
+}
+
+static void cpus_stop(void) {
+    unsigned long long t[2];
+    cpus_read(t);
+    for(int j = 0; j < 2; j++)
+        bench->throttle[j] += t[j] - bench->throttle_start[j];
+}
+
+int process_start_measure(void) {
+    bench->verify_measured = 0;
+    bench->measuring = 1;
+    getrusage(RUSAGE_SELF, &bench->usage_start);
+    #ifdef BENCH_ALLOC
+    task_register_thread();
+    alloc_snapshot(&bench->alloc_measured, 1);
+    #endif
+    if(prof_on()) task_register_thread();
+    for(struct task_recorder * r = bench->recorders; r != NULL; r = r->next) {
+        r->busy_base = r->busy;
+        r->tasks_base = r->hist.count;
+    }
+    if(perf_on()) {
+        task_register_thread();
+        for(struct task_recorder * r = bench->recorders; r != NULL; r = r->next) {
+            perf_read(r, r->perf_base);
+            freq_read(r, r->freq_base);
+        }
+    }
+    cpus_read(bench->throttle_start);
+    rapl_read(bench->energy_start);
+    bench->begin_ticks = clk_timing();
+    bench->begin = bench->begin_ticks / clk_per_ns * 1e-9;
+    return 1;
+}
+
+int process_stop_measure(void) {
+    bench->end = rtclock();
+    bench->measuring = 0;
+    if(bench->samples_size == bench->samples_max) {
+        bench->samples_max = bench->samples_max ? bench->samples_max * 2 : 16;
+        bench->samples = realloc(bench->samples, sizeof(double) * bench->samples_max);
+        if(bench->samples == NULL) exit(EXIT_FAILURE);
+    }
+    bench->samples[bench->samples_size++] = bench->end - bench->begin - bench->verify_measured;
+    rapl_stop(bench->end - bench->begin);
+    cpus_stop();
+    usage_stop();
+    #ifdef BENCH_ALLOC
+    alloc_snapshot(&bench->alloc_measured, 0);
+    #endif
+    if(perf_on()) {
+        unsigned long long v[BENCH_COUNTERS];
+        for(struct task_recorder * r = bench->recorders; r != NULL; r = r->next) {
+            if(freq_read(r, v)) {
+                for(int i = 0; i < r->freq_size; i++)
+                    r->freq[i] += counter_delta(v[i], r->freq_base[i]);
+            }
+            if(!perf_read(r, v)) continue;
+            for(int i = 0; i < perf_size; i++)
+                bench->perf_total[i] += counter_delta(v[i], r->perf_base[i]);
+        }
+    }
+    return 1;
+}
+
+static int ull_cmp(const void * a, const void * b) {
+    unsigned long long x = *(const unsigned long long *) a, y = *(const unsigned long long *) b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Times BENCH_CALIBRATION empty tasks on the calling thread, which must
+ * own r, and keeps the median as the cost of the probes that lands
+ * inside a task. Leaves r cleared like task_init_measure.
+ */
+static void task_calibrate(struct task_recorder * r) {
+    unsigned long long v[BENCH_CALIBRATION], perf[BENCH_COUNTERS];
+    struct live_slot slot;
+    memcpy(perf, r->perf_tasks, sizeof(perf));
+    /*Timed with the live update in, but not shown as progress*/
+    if(live_slot != NULL) slot = *live_slot;
+    for(int i = 0; i < BENCH_CALIBRATION; i++) {
+        unsigned long long busy = r->busy;
+        task_start_measure();
+        task_stop_measure();
+        v[i] = r->busy - busy;
+    }
+    qsort(v, BENCH_CALIBRATION, sizeof(unsigned long long), ull_cmp);
+    r->overhead = v[BENCH_CALIBRATION / 2];
+    memcpy(r->perf_tasks, perf, sizeof(perf));
+    if(live_slot != NULL) *live_slot = slot;
+    r->ptr = 0;
+    r->loop = 0;
+    r->busy = 0;
+    r->busy_base = 0;
+    r->tasks_base = 0;
+    r->last_end = 0;
+    hist_clear(&r->hist);
+}
+
+/*The buffer is the recorder's, the timer the calling thread's*/
+static void prof_attach(struct task_recorder * r) {
+    r->prof = pmalloc(sizeof(unsigned long long) * BENCH_PROF_WORDS);
+    prof_arm();
+}
+
+/*
+ * Called once per thread and context, explicitly or on its first task.
+ * A thread coming back to a context finds the recorder it had there.
+ */
+static struct task_recorder * task_register(void) {
+    struct bench_ctx * b = bench;
+    struct task_recorder * r;
+    if(thread_serial == 0) thread_serial = __sync_add_and_fetch(&thread_serials, 1);
+    for(r = b->recorders; r != NULL; r = r->next) {
+        if(r->owner == thread_serial) {
+            recorder = r;
+            recorder_id = b->id;
+            return r;
+        }
+    }
+    if(posix_memalign((void **) &r, BENCH_CACHE_LINE, sizeof(struct task_recorder)))
+        exit(EXIT_FAILURE);
+    r->owner = thread_serial;
+    r->start = 0;
+    r->ptr = 0;
+    r->loop = 0;
+    memset(&r->region_root, 0, sizeof(struct bench_region));
+    r->region_cur = &r->region_root;
+    memset(r->perf_base, 0, sizeof(r->perf_base));
+    memset(r->perf_tasks, 0, sizeof(r->perf_tasks));
+    r->perf_scaled = 0;
+    memset(&r->alloc, 0, sizeof(r->alloc));
+    memset(&r->alloc_base, 0, sizeof(r->alloc_base));
+    r->busy = 0;
+    r->last_end = 0;
+    r->counts_size = 0;
+    hist_clear(&r->hist);
+    perf_open_thread(r);
+    live_claim();
+    memset(r->freq_base, 0, sizeof(r->freq_base));
+    memset(r->freq, 0, sizeof(r->freq));
+    freq_open_thread(r);
+    r->prof = NULL;
+    r->prof_used = 0;
+    r->prof_samples = 0;
+    r->prof_dropped = 0;
+    if(prof_on()) prof_attach(r);
+    r->tid = __sync_fetch_and_add(&b->recorders_size, 1);
+    do {
+        r->next = b->recorders;
+    } while(!__sync_bool_compare_and_swap(&b->recorders, r->next, r));
+    recorder = r;
+    recorder_id = b->id;
+    task_calibrate(r);
+    return r;
+}
+
+/*
+ * Recorders are created lazily by each thread, this clears them and
+ * calibrates the calling thread again, the others did on registration.
+ */
+/*Forgets the tasks every recorder of the context remembers*/
+static void tasks_clear(void) {
+    for(struct task_recorder * r = bench->recorders; r != NULL; r = r->next) {
+        r->ptr = 0;
+        r->loop = 0;
+        r->busy = 0;
+        r->busy_base = 0;
+        r->tasks_base = 0;
+        r->last_end = 0;
+        memset(r->perf_tasks, 0, sizeof(r->perf_tasks));
+        hist_clear(&r->hist);
+    }
+}
+
+int task_init_measure(void) {
+    if(recorder != NULL && recorder_id == bench_id) task_calibrate(recorder);
+    tasks_clear();
+    return 1;
+}
+
+int task_stop_measure(void) {
+    unsigned long long t = clk_timing();
+    struct task_recorder * r = recorder;
+    if(r == NULL || recorder_id != bench_id) return 0;
+    if(r->perf_fd >= 0) {
+        unsigned long long v[BENCH_COUNTERS];
+        if(perf_read(r, v)) {
+            for(int i = 0; i < perf_size; i++)
+                r->perf_tasks[i] += counter_delta(v[i], r->perf_start[i]);
+        }
+    }
+    r->last_end = t;
+    t -= r->start;
+    r->busy += t;
+    hist_add(&r->hist, t);
+    if(live_slot != NULL) {
+        live_slot->tasks++;
+        live_slot->busy += t;
+        live_slot->last = r->last_end;
+    }
+    r->pool[r->ptr].start = r->start;
+    r->pool[r->ptr].size = t;
+    r->pool[r->ptr].tag = r->tag;
+    r->pool[r->ptr].cpu = r->cpu;
+    if(++r->ptr >= BENCH_TPT) {
+        r->ptr = 0;
+        r->loop = 1;
+    }
+    return 1;
+}
+
+int task_start_measure_tag(long long tag) {
+    struct task_recorder * r = recorder;
+    if(r == NULL || recorder_id != bench_id) r = task_register();
+    r->tag = tag;
+    #ifdef __linux__
+    r->cpu = sched_getcpu();
+    #else
+    r->cpu = -1;
+    #endif
+    if(r->perf_fd >= 0) perf_read(r, r->perf_start);
+    r->start = clk_timing();
+    return 1;
+}
+
+int task_start_measure(void) {
+    return task_start_measure_tag(-1);
+}
+
+/*Index of name in c, or size if absent. Names are usually literals, so the pointer test hits first*/
+static int count_find(struct task_count * c, int size, const char * name) {
+    int i;
+    for(i = 0; i < size; i++)
+        if(c[i].name == name || strcmp(c[i].name, name) == 0) break;
+    return i;
+}
+
+int process_add_metric(const char * name, double value, const char * unit) {
+    struct bench_metric * m = bench->metrics;
+    int i;
+    for(i = 0; i < bench->metrics_size; i++)
+        if(strcmp(m[i].name, name) == 0) break;
+    if(i == BENCH_METRICS) return 0;
+    if(i == bench->metrics_size) {
+        m[i].name = name;
+        m[i].unit = unit;
+        m[i].value = 0;
+        bench->metrics_size++;
+    }
+    m[i].value += value;
+    return 1;
+}
+
+int task_add_count(const char * name, unsigned long long n) {
+    struct task_recorder * r = recorder;
+    if(!bench->measuring) return 0;
+    if(r == NULL || recorder_id != bench_id) r = task_register();
+    int i = count_find(r->counts, r->counts_size, name);
+    if(i == BENCH_METRICS) return 0;
+    if(i == r->counts_size) {
+        r->counts[i].name = name;
+        r->counts[i].value = 0;
+        r->counts_size++;
+    }
+    r->counts[i].value += n;
+    return 1;
+}
+
+int task_register_thread(void) {
+    struct task_recorder * r = recorder;
+    if(r == NULL || recorder_id != bench_id) r = task_register();
+    return r->tid;
+}
+
+int bench_region_begin(const char * name) {
+    struct task_recorder * r = recorder;
+    if(r == NULL || recorder_id != bench_id) r = task_register();
+    struct bench_region * p = r->region_cur;
+    struct bench_region ** link = &p->child;
+    struct bench_region * c;
+    /*Names are usually literals, so the pointer test hits first*/
+    for(c = *link; c != NULL; link = &c->sibling, c = *link)
+        if(c->name == name || strcmp(c->name, name) == 0) break;
+    if(c == NULL) {
+        c = pmalloc(sizeof(struct bench_region));
+        memset(c, 0, sizeof(struct bench_region));
+        c->name = name;
+        c->threads = 1;
+        c->parent = p;
+        *link = c;
+    }
+    r->region_cur = c;
+    c->start = clk_timing();
+    return 1;
+}
+
+/*Ends the innermost region of r at tick t*/
+static void region_end(struct task_recorder * r, unsigned long long t) {
+    struct bench_region * c = r->region_cur;
+    t -= c->start;
+    c->inclusive += t;
+    c->calls++;
+    c->parent->nested += t;
+    r->region_cur = c->parent;
+}
+
+int bench_region_end(void) {
+    unsigned long long t = clk_timing();
+    struct task_recorder * r = recorder;
+    if(r == NULL || recorder_id != bench_id || r->region_cur == &r->region_root) return 0;
+    region_end(r, t);
+    return 1;
+}
+
+#ifdef BENCH_HAS_OMPT
+
+/*
+ * OMPT tool, built into the -fopenmp object when the compiler ships
+ * omp-tools.h (clang with libomp, libgomp has no OMPT) and started by
+ * the runtime when BENCH_OMPT=1. It feeds the recorders on its own:
+ *   regions "omp parallel" (on every thread of the team), inside it
+ *   "omp loop", "omp sections", "omp single" and "omp barrier wait",
+ *   "omp taskwait wait" or "omp taskgroup wait" for the waits;
+ *   one task per work-sharing chunk, tagged with its first iteration,
+ *   and one per explicit task segment, tagged with the task's number.
+ * Runtimes that never dispatch (libomp up to 14 reports the callback as
+ * ompt_set_never) give one task per thread and construct instead.
+ * libomp tells a worker its join barrier wait and implicit task ended
+ * only when it wakes for the next parallel region, or never after the
+ * last one. The primary closes the workers' regions at parallel_end
+ * instead and their late callbacks are dropped.
+ * Programs that already time their loop bodies should not enable it.
+ */
+static __thread int ompt_in_work; /*Inside a work-sharing construct*/
+static __thread int ompt_dispatched; /*Its open task is a dispatched chunk*/
+static __thread long long ompt_chunk; /*Tag of that chunk*/
+static __thread int ompt_suspended; /*An explicit task interrupted it*/
+static unsigned long long ompt_tasks; /*Explicit tasks created, their tags*/
+
+/*A worker of the current team, the primary reaches it through the parallel data*/
+struct ompt_member {
+    struct task_recorder * r;
+    struct bench_region * region; /*Its "omp parallel"*/
+    int open; /*Its implicit task runs*/
+    int closed; /*Ended by the primary, drop the late end callbacks*/
+};
+
+struct ompt_team {
+    unsigned int size;
+    struct ompt_member * members[];
+};
+
+static __thread struct ompt_member ompt_member;
+
+static void ompt_thread_begin(ompt_thread_t type, ompt_data_t * thread) {
+    task_register_thread();
+}
+
+static void ompt_parallel_begin(ompt_data_t * task, const ompt_frame_t * frame, ompt_data_t * parallel,
+        unsigned int requested, int flags, const void * codeptr) {
+    struct ompt_team * team = calloc(1, sizeof(struct ompt_team) + sizeof(struct ompt_member *) * requested);
+    if(team != NULL) team->size = requested;
+    parallel->ptr = team;
+    bench_region_begin("omp parallel");
+}
+
+/*The workers are parked in the join barrier, their regions end with the primary's*/
+static void ompt_parallel_end(ompt_data_t * parallel, ompt_data_t * task, int flags, const void * codeptr) {
+    unsigned long long t = clk_timing();
+    struct ompt_team * team = parallel->ptr;
+    for(unsigned int i = 0; team != NULL && i < team->size; i++) {
+        struct ompt_member * m = team->members[i];
+        if(m == NULL || !m->open) continue;
+        while(m->r->region_cur != m->region->parent && m->r->region_cur != &m->r->region_root)
+            region_end(m->r, t);
+        m->open = 0;
+        m->closed = 1;
+    }
+    free(team);
+    parallel->ptr = NULL;
+    bench_region_end();
+}
+
+/*The primary thread already opened the region in ompt_parallel_begin*/
+static void ompt_implicit_task(ompt_scope_endpoint_t endpoint, ompt_data_t * parallel, ompt_data_t * task,
+        unsigned int actual, unsigned int index, int flags) {
+    struct ompt_member * m = &ompt_member;
+    task->value = 0;
+    if((flags & ompt_task_initial) || index == 0) return;
+    if(endpoint == ompt_scope_begin) {
+        struct ompt_team * team = parallel != NULL ? parallel->ptr : NULL;
+        bench_region_begin("omp parallel");
+        m->r = recorder;
+        m->region = recorder->region_cur;
+        m->open = 1;
+        m->closed = 0;
+        if(team != NULL && index < team->size) team->members[index] = m;
+    } else if(m->closed) {
+        m->closed = 0;
+    } else {
+        m->open = 0;
+        bench_region_end();
+    }
+}
+
+static const char * ompt_work_name(ompt_work_t type) {
+    switch(type) {
+        case ompt_work_sections: return "omp sections";
+        case ompt_work_single_executor: return "omp single";
+        case ompt_work_distribute: return "omp distribute";
+        case ompt_work_loop: return "omp loop";
+        default: return type >= 10 ? "omp loop" : NULL; /*OpenMP 5.2 loop schedules*/
+    }
+}
+
+/*
+ * A construct is one task per thread until the runtime dispatches
+ * chunks, then every chunk is one; the first dispatch only restarts
+ * the clock so the time before it is not a task of its own.
+ */
+static void ompt_work(ompt_work_t type, ompt_scope_endpoint_t endpoint, ompt_data_t * parallel,
+        ompt_data_t * task, uint64_t count, const void * codeptr) {
+    const char * name = ompt_work_name(type);
+    if(name == NULL) return;
+    if(endpoint == ompt_scope_begin) {
+        bench_region_begin(name);
+        ompt_in_work = 1;
+        ompt_dispatched = 0;
+        ompt_chunk = -1;
+        task_start_measure();
+    } else {
+        if(!ompt_suspended) task_stop_measure();
+        ompt_in_work = 0;
+        ompt_suspended = 0;
+        bench_region_end();
+    }
+}
+
+struct ompt_chunk {
+    uint64_t start;
+    uint64_t iterations;
+};
+
+static void ompt_dispatch(ompt_data_t * parallel, ompt_data_t * task, ompt_dispatch_t kind, ompt_data_t instance) {
+    if(!ompt_in_work || ompt_suspended) return;
+    if(ompt_dispatched) task_stop_measure();
+    /*ompt_dispatch_ws_loop_chunk of OpenMP 5.2 passes the chunk's bounds*/
+    if(kind == ompt_dispatch_iteration) ompt_chunk = instance.value;
+    else if((int) kind == 3 && instance.ptr != NULL) ompt_chunk = ((struct ompt_chunk *) instance.ptr)->start;
+    else ompt_chunk = -1;
+    ompt_dispatched = 1;
+    task_start_measure_tag(ompt_chunk);
+}
+
+static void ompt_task_create(ompt_data_t * task, const ompt_frame_t * frame, ompt_data_t * created,
+        int flags, int dependences, const void * codeptr) {
+    created->value = (flags & ompt_task_explicit) ? __sync_add_and_fetch(&ompt_tasks, 1) : 0;
+}
+
+/*Explicit tasks may start inside a chunk, which resumes as a new task after them*/
+static void ompt_task_schedule(ompt_data_t * prior, ompt_task_status_t status, ompt_data_t * next) {
+    if(prior != NULL && prior->value > 0) task_stop_measure();
+    if(next != NULL && next->value > 0) {
+        if(ompt_in_work && !ompt_suspended) {
+            task_stop_measure();
+            ompt_suspended = 1;
+        }
+        task_start_measure_tag(next->value);
+    } else if(ompt_suspended) {
+        ompt_suspended = 0;
+        task_start_measure_tag(ompt_chunk);
+    }
+}
+
+static void ompt_sync_wait(ompt_sync_region_t kind, ompt_scope_endpoint_t endpoint, ompt_data_t * parallel,
+        ompt_data_t * task, const void * codeptr) {
+    const char * name;
+    switch(kind) {
+        case ompt_sync_region_taskwait: name = "omp taskwait wait"; break;
+        case ompt_sync_region_taskgroup: name = "omp taskgroup wait"; break;
+        case ompt_sync_region_reduction: return;
+        default: name = "omp barrier wait";
+    }
+    if(endpoint == ompt_scope_begin) bench_region_begin(name);
+    else if(!ompt_member.closed) bench_region_end();
+}
+
+static int ompt_tool_init(ompt_function_lookup_t lookup, int device, ompt_data_t * data) {
+    ompt_set_callback_t set = (ompt_set_callback_t) lookup("ompt_set_callback");
+    if(set == NULL) return 0;
+    set(ompt_callback_thread_begin, (ompt_callback_t) ompt_thread_begin);
+    set(ompt_callback_parallel_begin, (ompt_callback_t) ompt_parallel_begin);
+    set(ompt_callback_parallel_end, (ompt_callback_t) ompt_parallel_end);
+    set(ompt_callback_implicit_task, (ompt_callback_t) ompt_implicit_task);
+    set(ompt_callback_work, (ompt_callback_t) ompt_work);
+    set(ompt_callback_dispatch, (ompt_callback_t) ompt_dispatch);
+    set(ompt_callback_task_create, (ompt_callback_t) ompt_task_create);
+    set(ompt_callback_task_schedule, (ompt_callback_t) ompt_task_schedule);
+    set(ompt_callback_sync_region_wait, (ompt_callback_t) ompt_sync_wait);
+    return 1;
+}
+
+static void ompt_tool_fini(ompt_data_t * data) {
+}
+
+ompt_start_tool_result_t * ompt_start_tool(unsigned int version, const char * runtime) {
+    static ompt_start_tool_result_t tool = {ompt_tool_init, ompt_tool_fini, {0}};
+    char * e = getenv("BENCH_OMPT");
+    return e != NULL && strcmp(e, "0") != 0 ? &tool : NULL;
+}
+
+#endif
+
+/*Adds the children of src into dst, matching them by name*/
+static void region_merge(struct bench_region * dst, struct bench_region * src) {
+    for(struct bench_region * s = src->child; s != NULL; s = s->sibling) {
+        struct bench_region ** link = &dst->child;
+        struct bench_region * d;
+        for(d = *link; d != NULL; link = &d->sibling, d = *link)
+            if(strcmp(d->name, s->name) == 0) break;
+        if(d == NULL) {
+            d = pmalloc(sizeof(struct bench_region));
+            memset(d, 0, sizeof(struct bench_region));
+            d->name = s->name;
+            d->parent = dst;
+            *link = d;
+        }
+        d->inclusive += s->inclusive;
+        d->nested += s->nested;
+        d->calls += s->calls;
+        d->threads++;
+        alloc_add(&d->alloc, &s->alloc);
+        region_merge(d, s);
+    }
+}
+
+/*
+ * Charges the regions a thread still has open, from c up, into the
+ * merged tree until now, the thread's own tree is left alone. Returns
+ * the merged node of c, NULL if the thread entered it after the merge.
+ */
+static struct bench_region * region_open(struct bench_region * merged, struct task_recorder * r,
+        struct bench_region * c, unsigned long long now) {
+    if(c == &r->region_root) return merged;
+    struct bench_region * p = region_open(merged, r, c->parent, now), * d;
+    if(p == NULL) return NULL;
+    for(d = p->child; d != NULL; d = d->sibling)
+        if(strcmp(d->name, c->name) == 0) break;
+    if(d == NULL) return NULL;
+    unsigned long long t = now > c->start ? now - c->start : 0;
+    d->inclusive += t;
+    d->open++;
+    p->nested += t;
+    return d;
+}
+
+static void region_free(struct bench_region * n) {
+    struct bench_region * c = n->child;
+    while(c != NULL) {
+        struct bench_region * next = c->sibling;
+        region_free(c);
+        free(c);
+        c = next;
+    }
+}
+
+#ifdef BENCH_ALLOC
+static void alloc_dump(FILE * f, const char * key, struct alloc_count * c) {
+    fprintf(f, "\"%s\" : {\"count\" : %llu,\"frees\" : %llu,\"bytes\" : %llu,\"ticks\" : %llu}",
+        key, c->count, c->frees, c->bytes, c->ticks);
+}
+#endif
+
+static void region_dump(FILE * f, struct bench_region * n) {
+    for(struct bench_region * c = n->child; c != NULL; c = c->sibling) {
+        fprintf(f, "{\"name\" : \"%s\",\"calls\" : %llu,\"threads\" : %d,\"inclusive\" : %llu,\"exclusive\" : %llu,",
+            c->name, c->calls, c->threads, c->inclusive, c->inclusive > c->nested ? c->inclusive - c->nested : 0);
+        if(c->open > 0) fprintf(f, "\"open\" : %d,", c->open);
+        #ifdef BENCH_ALLOC
+        alloc_dump(f, "allocations", &c->alloc);
+        fprintf(f, ",");
+        #endif
+        fprintf(f, "\"children\" : [");
+        region_dump(f, c);
+        fprintf(f, "]}%s", c->sibling != NULL ? "," : "");
+    }
+}
+
+static struct task_recorder ** recorders_by_tid(void) {
+    struct task_recorder ** by_tid = pmalloc(sizeof(struct task_recorder *) * (bench->recorders_size + 1));
+    for(struct task_recorder * r = bench->recorders; r != NULL; r = r->next)
+        by_tid[r->tid] = r;
+    return by_tid;
+}
+
+static int recorder_count(struct task_recorder * r) {
+    return r->loop ? BENCH_TPT : r->ptr;
+}
+
+/*j-th remembered task, oldest first since the ring may have wrapped*/
+static struct task_sample * recorder_task(struct task_recorder * r, int j) {
+    return &r->pool[r->loop ? (r->ptr + j) % BENCH_TPT : j];
+}
+
+int process_trace(char * path) {
+    bench->trace_path = path;
+    return 1;
+}
+
+static void trace_write(FILE * t, EVP_MD_CTX * ctx, const void * data, size_t size) {
+    fwrite(data, 1, size, t);
+    EVP_DigestUpdate(ctx, data, size);
+}
+
+static void trace_u64(FILE * t, EVP_MD_CTX * ctx, unsigned long long v) {
+    unsigned char b[8];
+    for(int i = 0; i < 8; i++)
+        b[i] = v >> (8 * i);
+    trace_write(t, ctx, b, 8);
+}
+
+/*
+ * Binary trace, every field a little endian u64:
+ *   magic "BNCHTRC1", version (2), threads, ticks_per_ns (IEEE double bits)
+ *   per thread: tid, tasks, byte offset of its records
+ *   per thread: tasks x (start, duration, tag, cpu), times in ticks,
+ *   oldest first. Version 1 records were only (start, duration).
+ */
+static int trace_dump(struct task_recorder ** by_tid, int q, unsigned char * d) {
+    FILE * t = fopen(bench->trace_path, "wb");
+    if(t == NULL) return 0;
+    EVP_MD_CTX * ctx = digest_new();
+    unsigned long long offset = 8 * 4 + 24 * (unsigned long long) q, bits;
+    memcpy(&bits, &clk_per_ns, sizeof(bits));
+    trace_write(t, ctx, "BNCHTRC1", 8);
+    trace_u64(t, ctx, 2);
+    trace_u64(t, ctx, q);
+    trace_u64(t, ctx, bits);
+    for(int i = 0; i < q; i++) {
+        trace_u64(t, ctx, by_tid[i]->tid);
+        trace_u64(t, ctx, recorder_count(by_tid[i]));
+        trace_u64(t, ctx, offset);
+        offset += sizeof(struct task_sample) * (unsigned long long) recorder_count(by_tid[i]);
+    }
+    for(int i = 0; i < q; i++) {
+        struct task_recorder * r = by_tid[i];
+        #if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        /*The ring is already in the file layout, at most two slices*/
+        if(r->loop)
+            trace_write(t, ctx, r->pool + r->ptr, sizeof(struct task_sample) * (BENCH_TPT - r->ptr));
+        trace_write(t, ctx, r->pool, sizeof(struct task_sample) * r->ptr);
+        #else
+        for(int j = 0; j < recorder_count(r); j++) {
+            trace_u64(t, ctx, recorder_task(r, j)->start);
+            trace_u64(t, ctx, recorder_task(r, j)->size);
+            trace_u64(t, ctx, recorder_task(r, j)->tag);
+            trace_u64(t, ctx, recorder_task(r, j)->cpu);
+        }
+        #endif
+    }
+    EVP_DigestFinal_ex(ctx, d, NULL);
+    EVP_MD_CTX_free(ctx);
+    return fclose(t) == 0;
+}
+
+int process_timeline(char * path) {
+    bench->timeline_path = path;
+    return 1;
+}
+
+/*
+ * Chrome trace event format, which Perfetto and chrome://tracing read:
+ * one complete event per task, microseconds from process_start_measure.
+ */
+static int timeline_dump(struct task_recorder ** by_tid, int q) {
+    FILE * t = fopen(bench->timeline_path, "w");
+    if(t == NULL) return 0;
+    double us = clk_per_ns * 1000;
+    fprintf(t, "{\"displayTimeUnit\" : \"ns\", \"traceEvents\" : [\n");
+    fprintf(t, "{\"name\" : \"process_name\",\"ph\" : \"M\",\"pid\" : 0,\"args\" : {\"name\" : \"%s %s\"}}",
+        bench->name, mode[bench->mode]);
+    for(int i = 0; i < q; i++) {
+        struct task_recorder * r = by_tid[i];
+        fprintf(t, ",\n{\"name\" : \"thread_name\",\"ph\" : \"M\",\"pid\" : 0,\"tid\" : %d,\"args\" : {\"name\" : \"thread %d\"}}",
+            r->tid, r->tid);
+        for(int j = 0; j < recorder_count(r); j++) {
+            struct task_sample * s = recorder_task(r, j);
+            fprintf(t, ",\n{\"name\" : \"task\",\"ph\" : \"X\",\"pid\" : 0,\"tid\" : %d,\"ts\" : %.3f,\"dur\" : %.3f,\"args\" : {\"tag\" : %lld,\"cpu\" : %lld}}",
+                r->tid, (long long) (s->start - bench->begin_ticks) / us, s->size / us, s->tag, s->cpu);
+        }
+    }
+    fprintf(t, "\n]}\n");
+    return fclose(t) == 0;
+}
+
+int process_profile(char * path) {
+    struct task_recorder * r = recorder;
+    bench->profile_path = path;
+    prof_on();
+    #ifdef BENCH_HAS_PROF
+    prof_enabled = 1;
+    #endif
+    /*Registered before, the other threads stay unsampled*/
+    if(prof_enabled && r != NULL && recorder_id == bench_id && r->prof == NULL) prof_attach(r);
+    return prof_enabled;
+}
+
+static int line_cmp(const void * a, const void * b) {
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+/*
+ * Collapsed stacks: one "outer;...;inner count" line per distinct stack,
+ * what flamegraph.pl, inferno and speedscope read.
+ */
+static int profile_dump(unsigned long long * samples) {
+    unsigned long long n = 0, i, j;
+    char frame[256];
+    for(struct task_recorder * r = bench->recorders; r != NULL; r = r->next)
+        n += r->prof_samples;
+    char ** lines = pmalloc(sizeof(char *) * (n + 1));
+    n = 0;
+    for(struct task_recorder * r = bench->recorders; r != NULL; r = r->next) {
+        for(int w = 0; w < r->prof_used; w += 1 + r->prof[w]) {
+            int depth = r->prof[w];
+            size_t len = 0;
+            char * line = pmalloc(sizeof(frame) * depth);
+            for(int k = depth - 1; k >= 0; k--) {
+                /*Return addresses point after their call*/
+                prof_symbol(frame, sizeof(frame), r->prof[w + 1 + k] - (k > 0));
+                len += sprintf(line + len, "%s%s", k < depth - 1 ? ";" : "", frame);
+            }
+            lines[n++] = line;
+        }
+    }
+    *samples = n;
+    qsort(lines, n, sizeof(char *), line_cmp);
+    FILE * t = fopen(bench->profile_path, "w");
+    for(i = 0; i < n; i = j) {
+        for(j = i + 1; j < n && strcmp(lines[i], lines[j]) == 0; j++)
+            free(lines[j]);
+        if(t != NULL) fprintf(t, "%s %llu\n", lines[i], j - i);
+        free(lines[i]);
+    }
+    free(lines);
+    return t != NULL && fclose(t) == 0;
+}
+
+static unsigned long long ticks_less(unsigned long long v, double o) {
+    return v > o ? (unsigned long long) (v - o + 0.5) : 0;
+}
+
+/*
+ * With corrected, the threads' overheads, weighted by their task counts,
+ * are taken off every statistic but the spread.
+ */
+static void hist_dump(FILE * f, const char * key, int corrected) {
+    struct task_hist * h = pmalloc(sizeof(struct task_hist));
+    double o = 0;
+    hist_clear(h);
+    for(struct task_recorder * r = bench->recorders; r != NULL; r = r->next) {
+        hist_merge(h, &r->hist);
+        o += (double) r->overhead * r->hist.count;
+    }
+    if(h->count == 0) {
+        free(h);
+        return;
+    }
+    o = corrected ? o / h->count : 0;
+    double mean = h->sum / h->count;
+    double var = h->count > 1 ? (h->sum_sq - h->sum * mean) / (h->count - 1) : 0;
+    /*Clamped at 0 like every other corrected figure*/
+    fprintf(f, ", \"%s\" : {\"count\" : %llu,\"min\" : %llu,\"mean\" : %lf,\"stddev\" : %lf,\"p50\" : %llu,\"p90\" : %llu,\"p99\" : %llu,\"max\" : %llu}",
+        key, h->count, ticks_less(h->min, o), mean > o ? mean - o : 0, var > 0 ? sqrt(var) : 0,
+        ticks_less(hist_percentile(h, 0.5), o), ticks_less(hist_percentile(h, 0.9), o),
+        ticks_less(hist_percentile(h, 0.99), o), ticks_less(h->max, o));
+    free(h);
+}
+
+/*
+ * Busy is the time a thread spent in tasks, idle the rest of the time
+ * from process_start_measure to the end of its last task. Both cover the
+ * last measured sample only. The imbalance factor is max/mean busy over
+ * the threads that ran tasks in it, 1 when the work was spread evenly.
+ */
+static void imbalance_dump(FILE * f, struct task_recorder ** by_tid, int q) {
+    unsigned long long max = 0;
+    double sum = 0;
+    int n = 0;
+    for(int i = 0; i < q; i++) {
+        struct task_recorder * r = by_tid[i];
+        if(r->hist.count == r->tasks_base) continue;
+        if(r->busy - r->busy_base > max) max = r->busy - r->busy_base;
+        sum += r->busy - r->busy_base;
+        n++;
+    }
+    double factor = sum > 0 ? max / (sum / n) : 1;
+    fprintf(f, ", \"imbalance\" : {\"factor\" : %lf,\"percent\" : %lf,\"threads\" : [", factor, (factor - 1) * 100);
+    for(int i = 0, first = 1; i < q; i++) {
+        struct task_recorder * r = by_tid[i];
+        if(r->hist.count == r->tasks_base) continue;
+        unsigned long long busy = r->busy - r->busy_base;
+        long long span = r->last_end - bench->begin_ticks;
+        long long idle = span - (long long) busy;
+        fprintf(f, "%s{\"tid\" : %d,\"tasks\" : %llu,\"busy\" : %llu,\"idle\" : %lld,\"end\" : %lld}",
+            first ? "" : ",", r->tid, r->hist.count - r->tasks_base, busy, idle > 0 ? idle : 0, span);
+        first = 0;
+    }
+    fprintf(f, "]}");
+}
+
+static void overhead_dump(FILE * f, struct task_recorder ** by_tid, int q) {
+    double sum = 0;
+    for(int i = 0; i < q; i++)
+        sum += by_tid[i]->overhead;
+    fprintf(f, ", \"overhead\" : {\"ticks\" : %lf,\"threads\" : [", q ? sum / q : 0);
+    for(int i = 0; i < q; i++)
+        fprintf(f, "%s%llu", i ? "," : "", by_tid[i]->overhead);
+    fprintf(f, "]}");
+}
+
+/*
+ * Base clock (TSC rate, else cpufreq base_frequency), cpufreq readings,
+ * throttle events and the clock each thread ran at in the measured
+ * region. A run is throttled when throttle events happened or a thread
+ * ran below BENCH_THROTTLE_RATIO of the base clock.
+ */
+static void frequency_dump(FILE * f) {
+    double nominal = clk_source == CLK_TSC ? clk_per_ns : cpu_base_khz * 1e-6;
+    double weighted = 0, busy = 0;
+    int throttled = bench->throttle[0] + bench->throttle[1] > 0, n = 0;
+    struct task_recorder ** by_tid = recorders_by_tid();
+    for(int i = 0; i < bench->recorders_size; i++)
+        n += by_tid[i]->freq[0] > 0 && by_tid[i]->freq[1] > 0;
+    if(n == 0 && !bench->throttle_known && bench->mhz_readings == 0) {
+        free(by_tid);
+        return;
+    }
+    fprintf(f, ", \"frequency\" : {");
+    if(nominal > 0) fprintf(f, "\"base_ghz\" : %lf,", nominal);
+    if(bench->mhz_readings > 0)
+        fprintf(f, "\"cpufreq\" : {\"min_mhz\" : %lf,\"mean_mhz\" : %lf,\"max_mhz\" : %lf},",
+            bench->mhz_min, bench->mhz_sum / bench->mhz_readings, bench->mhz_max);
+    if(bench->throttle_known)
+        fprintf(f, "\"throttle\" : {\"core\" : %llu,\"package\" : %llu},", bench->throttle[0], bench->throttle[1]);
+    fprintf(f, "\"threads\" : [");
+    n = 0;
+    for(int i = 0; i < bench->recorders_size; i++) {
+        unsigned long long * v = by_tid[i]->freq;
+        double ghz = 0, ratio = 0;
+        if(v[0] == 0 || v[1] == 0) continue;
+        /*The task clock counts nanoseconds*/
+        if(by_tid[i]->freq_size > 2 && v[2] > 0) ratio = (double) v[0] / v[2];
+        ghz = ratio > 0 && nominal > 0 ? ratio * nominal : (double) v[0] / v[1];
+        fprintf(f, "%s{\"tid\" : %d,\"ghz\" : %lf", n++ ? "," : "", i, ghz);
+        if(ratio > 0) fprintf(f, ",\"ratio\" : %lf", ratio);
+        fprintf(f, "}");
+        if(ratio > 0 && ratio < BENCH_THROTTLE_RATIO) throttled = 1;
+        weighted += ghz * v[1];
+        busy += v[1];
+    }
+    fprintf(f, "]");
+    if(busy > 0) fprintf(f, ",\"ghz\" : %lf", weighted / busy);
+    fprintf(f, ",\"throttled\" : %s}", throttled ? "true" : "false");
+    free(by_tid);
+}
+
+/*
+ * process_add_metric values as given, then the task_add_count counters
+ * summed over the threads with their rate over the measured time.
+ */
+static void metrics_dump(FILE * f) {
+    struct task_count total[BENCH_METRICS];
+    int n = 0, first = 1;
+    double seconds = 0;
+    for(int i = 0; i < bench->samples_size; i++)
+        seconds += bench->samples[i];
+    for(struct task_recorder * r = bench->recorders; r != NULL; r = r->next) {
+        for(int i = 0; i < r->counts_size; i++) {
+            int j = count_find(total, n, r->counts[i].name);
+            if(j == BENCH_METRICS) continue;
+            if(j == n) {
+                total[n].name = r->counts[i].name;
+                total[n++].value = 0;
+            }
+            total[j].value += r->counts[i].value;
+        }
+    }
+    if(bench->metrics_size == 0 && n == 0) return;
+    fprintf(f, ", \"metrics\" : {");
+    for(int i = 0; i < bench->metrics_size; i++, first = 0)
+        fprintf(f, "%s\"%s\" : {\"value\" : %lf,\"unit\" : \"%s\"}", first ? "" : ",",
+            bench->metrics[i].name, bench->metrics[i].value, bench->metrics[i].unit);
+    for(int i = 0; i < n; i++, first = 0)
+        fprintf(f, "%s\"%s\" : {\"value\" : %llu,\"per_second\" : %lf}", first ? "" : ",",
+            total[i].name, total[i].value, seconds > 0 ? total[i].value / seconds : 0);
+    fprintf(f, "}");
+}
+
+static void counters_dump(FILE * f, const char * key, unsigned long long * v) {
+    if(perf_size == 0) {
+        fprintf(f, ", \"%s\" : \"not available\"", key);
+        return;
+    }
+    int scaled = 0;
+    for(struct task_recorder * r = bench->recorders; r != NULL; r = r->next)
+        scaled |= r->perf_scaled;
+    fprintf(f, ", \"%s\" : {", key);
+    for(int i = 0; i < perf_size; i++)
+        fprintf(f, "%s\"%s\" : %llu", i ? "," : "", perf_names[i], v[i]);
+    if(scaled) fprintf(f, ",\"scaled\" : true");
+    fprintf(f, "}");
+}
+
+static int sample_cmp(const void * a, const void * b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+/*Sorts the samples and prints them with their summary*/
+static double samples_dump(FILE * f) {
+    double mean = 0, var = 0, median;
+    int n = bench->samples_size;
+    qsort(bench->samples, n, sizeof(double), sample_cmp);
+    for(int i = 0; i < n; i++)
+        mean += bench->samples[i];
+    mean /= n;
+    for(int i = 0; i < n; i++)
+        var += (bench->samples[i] - mean) * (bench->samples[i] - mean);
+    var = n > 1 ? var / (n - 1) : 0;
+    median = n % 2 ? bench->samples[n / 2] : (bench->samples[n / 2 - 1] + bench->samples[n / 2]) / 2;
+    fprintf(f, ", \"samples\" : [");
+    for(int i = 0; i < n; i++)
+        fprintf(f, "%s%lf", i ? "," : "", bench->samples[i]);
+    fprintf(f, "], \"stats\" : {\"min\" : %lf,\"median\" : %lf,\"mean\" : %lf,\"stddev\" : %lf,\"cv\" : %lf}",
+        bench->samples[0], median, mean, sqrt(var), mean > 0 ? sqrt(var) / mean : 0);
+    return median;
+}
+
+/*
+ * Contexts are meant to be created, switched and destroyed by the thread
+ * driving the runs while no task is timed, the lock only keeps the list
+ * whole if several threads create them at once.
+ */
+static void contexts_acquire(void) {
+    while(__sync_lock_test_and_set(&contexts_lock, 1))
+        sched_yield();
+}
+
+static void contexts_release(void) {
+    __sync_lock_release(&contexts_lock);
+}
+
+bench_ctx * bench_ctx_create(void) {
+    struct bench_ctx * c = pmalloc(sizeof(struct bench_ctx));
+    memset(c, 0, sizeof(struct bench_ctx));
+    c->phase = -1;
+    contexts_acquire();
+    c->id = contexts_next++;
+    struct bench_ctx ** link = &contexts;
+    while(*link != NULL)
+        link = &(*link)->next;
+    *link = c;
+    contexts_release();
+    return c;
+}
+
+bench_ctx * bench_ctx_use(bench_ctx * c) {
+    struct bench_ctx * prev = bench;
+    if(c == NULL) c = &bench_default;
+    bench = c;
+    bench_id = c->id;
+    return prev;
+}
+
+void bench_ctx_destroy(bench_ctx * c) {
+    if(c == NULL || c == &bench_default) return;
+    if(bench == c) bench_ctx_use(NULL);
+    contexts_acquire();
+    struct bench_ctx ** link = &contexts;
+    while(*link != NULL && *link != c)
+        link = &(*link)->next;
+    if(*link != NULL) *link = c->next;
+    contexts_release();
+    /*Threads still pointing at these recorders see another id and drop them*/
+    struct task_recorder * r = c->recorders;
+    while(r != NULL) {
+        struct task_recorder * next = r->next;
+        perf_close_thread(r);
+        region_free(&r->region_root);
+        free(r->prof);
+        free(r);
+        r = next;
+    }
+    for(int i = 0; i < c->parts_size; i++)
+        if(c->parts[i].ctx != NULL) EVP_MD_CTX_free(c->parts[i].ctx);
+    free(c->parts);
+    if(c->out_ctx != NULL) EVP_MD_CTX_free(c->out_ctx);
+    free(c->samples);
+    free(c->args);
+    free(c->env_paths[0]);
+    free(c->env_paths[1]);
+    free(c->env_paths[2]);
+    #ifdef DEBUG
+    free(c->out);
+    #endif
+    free(c);
+}
+
+/*BENCH_TRACE and BENCH_TIMELINE name the default context's files, others add .<id>*/
+static char * env_path(const char * key, int i) {
+    char * e = getenv(key);
+    if(e == NULL || bench->id == 0) return e;
+    if(bench->env_paths[i] == NULL) {
+        bench->env_paths[i] = pmalloc(strlen(e) + 16);
+        sprintf(bench->env_paths[i], "%s.%d", e, bench->id);
+    }
+    return bench->env_paths[i];
+}
+
+static void run_dump(FILE * f) {
+    fprintf(f, "{\"bench\" : \"%s\", \"id\" : \"\",\"mode\" : \"%s\",\"args\" : \"%s\"", bench->name, mode[bench->mode], bench->args);
+    /*Repeated runs report their median as the time*/
+    if(bench->samples_size > 1)
+        fprintf(f, ",\"time\" : %lf", samples_dump(f));
+    else
+        fprintf(f, ",\"time\" : %lf", bench->end - bench->begin - bench->verify_measured);
+    if(bench->verify_time > 0)
+        fprintf(f, ", \"verify\" : %lf", bench->verify_time);
+    phases_dump(f);
+    fprintf(f, ", \"clock\" : {\"source\" : \"%s\",\"ticks_per_ns\" : %lf,\"invariant_tsc\" : %s}",
+        clk_names[clk_source], clk_per_ns, clk_invariant ? "true" : "false");
+    if(perf_on())
+        counters_dump(f, "counters", bench->perf_total);
+    #ifdef BENCH_ALLOC
+    if(bench->recorders_size > 0) {
+        struct alloc_count total = bench->alloc_orphan;
+        fprintf(f, ", \"allocations\" : {");
+        alloc_dump(f, "measured", &bench->alloc_measured);
+        fprintf(f, ", \"threads\" : [");
+        struct task_recorder ** by_tid = recorders_by_tid();
+        for(int i = 0; i < bench->recorders_size; i++) {
+            fprintf(f, "%s{\"tid\" : %d,", i ? "," : "", i);
+            alloc_dump(f, "total", &by_tid[i]->alloc);
+            fprintf(f, "}");
+            alloc_add(&total, &by_tid[i]->alloc);
+        }
+        free(by_tid);
+        fprintf(f, "], ");
+        alloc_dump(f, "unregistered", &bench->alloc_orphan);
+        fprintf(f, ", ");
+        alloc_dump(f, "total", &total);
+        fprintf(f, "}");
+    }
+    #endif
+    if(bench->usage.taken)
+        fprintf(f, ", \"resources\" : {\"peak_rss_kb\" : %ld,\"rss_kb\" : %ld,\"minor_faults\" : %ld,\"major_faults\" : %ld,\"voluntary_cs\" : %ld,\"involuntary_cs\" : %ld,\"user_time\" : %lf,\"system_time\" : %lf}",
+            bench->usage.peak_rss_kb, bench->usage.rss_kb, bench->usage.minor_faults, bench->usage.major_faults,
+            bench->usage.voluntary_cs, bench->usage.involuntary_cs, bench->usage.user_time, bench->usage.system_time);
+    metrics_dump(f);
+    frequency_dump(f);
+    locks_dump(f);
+    if(rapl_size > 0 && bench->energy_time > 0) {
+        fprintf(f, ", \"energy\" : {\"time\" : %lf,\"domains\" : [", bench->energy_time);
+        for(int i = 0; i < rapl_size; i++)
+            fprintf(f, "%s{\"name\" : \"%s\",\"joules\" : %lf,\"watts\" : %lf}", i ? "," : "",
+                rapl[i].name, bench->energy[i], bench->energy[i] / bench->energy_time);
+        fprintf(f, "]}");
+    }
+    
+    int q = bench->recorders_size, recorded = 0;
+    for(struct task_recorder * r = bench->recorders; r != NULL; r = r->next)
+        recorded += r->loop || r->ptr > 0;
+    if(recorded > 0) {
+        struct task_recorder ** by_tid = recorders_by_tid();
+        if(bench->trace_path == NULL) bench->trace_path = env_path("BENCH_TRACE", 0);
+        if(bench->trace_path != NULL) {
+            unsigned char d[EVP_MAX_MD_SIZE];
+            if(trace_dump(by_tid, q, d)) {
+                fprintf(f, ", \"tasks\" : \"trace\", \"trace\" : {\"path\" : \"%s\",\"sha256\" : \"", bench->trace_path);
+                for(int i = 0; i < SHA256_DIGEST_LENGTH; i++)
+                    fprintf(f, "%02hhx", d[i]);
+                fprintf(f, "\"}");
+            } else {
+                fprintf(f, ", \"tasks\" : \"not available\"");
+            }
+        } else {
+            fprintf(f, ", \"tasks\" : [");
+            for(int i = 0; i < q; i++) {
+                struct task_recorder * r = by_tid[i];
+                for(int j = 0; j < recorder_count(r); j++)
+                    fprintf(f, "%llu,", recorder_task(r, j)->size);
+            }
+            fprintf(f,"0 ]");
+        }
+        if(bench->timeline_path == NULL) bench->timeline_path = env_path("BENCH_TIMELINE", 1);
+        if(bench->timeline_path != NULL && timeline_dump(by_tid, q))
+            fprintf(f, ", \"timeline\" : \"%s\"", bench->timeline_path);
+        imbalance_dump(f, by_tid, q);
+        overhead_dump(f, by_tid, q);
+        free(by_tid);
+        hist_dump(f, "task_stats", 0);
+        hist_dump(f, "task_stats_corrected", 1);
+        if(perf_on()) {
+            unsigned long long v[BENCH_COUNTERS];
+            memset(v, 0, sizeof(v));
+            for(struct task_recorder * r = bench->recorders; r != NULL; r = r->next)
+                for(int i = 0; i < perf_size; i++)
+                    v[i] += r->perf_tasks[i];
+            counters_dump(f, "task_counters", v);
+        }
+    } else {
+        fprintf(f, ", \"tasks\" : \"not available\"");
+    }
+
+    struct bench_region merged;
+    unsigned long long now = clk_timing();
+    memset(&merged, 0, sizeof(struct bench_region));
+    for(struct task_recorder * r = bench->recorders; r != NULL; r = r->next) {
+        region_merge(&merged, &r->region_root);
+        region_open(&merged, r, r->region_cur, now);
+    }
+    if(merged.child != NULL) {
+        fprintf(f, ", \"regions\" : [");
+        region_dump(f, &merged);
+        fprintf(f, "]");
+        region_free(&merged);
+    }
+
+    if(prof_on()) {
+        unsigned long long n, dropped = 0;
+        int unsampled = 0;
+        for(struct task_recorder * r = bench->recorders; r != NULL; r = r->next) {
+            dropped += r->prof_dropped;
+            unsampled += r->prof == NULL;
+        }
+        if(bench->profile_path == NULL) bench->profile_path = env_path("BENCH_PROFILE", 2);
+        if(bench->profile_path != NULL && profile_dump(&n)) {
+            fprintf(f, ", \"profile\" : {\"path\" : \"%s\",\"hz\" : %d,\"depth\" : %d,\"samples\" : %llu,\"dropped\" : %llu",
+                bench->profile_path, prof_hz, prof_depth, n, dropped);
+            if(unsampled > 0) fprintf(f, ",\"unsampled\" : %d", unsampled);
+            fprintf(f, "}");
+        }
+    }
+
+    #ifdef DEBUG
+    puts(bench->out);
+    #endif
+
+    if(bench->parts_size > 0)
+        fprintf(f, ",\"output_parts\" : %d", bench->parts_size);
+    fprintf(f, ",\"output\" : \"");
+	unsigned char d[EVP_MAX_MD_SIZE];
+	result_digest(d);
+	for(int i = 0; i < SHA256_DIGEST_LENGTH; i++)
+		fprintf(f, "%02hhx", d[i]);
+    fprintf(f, "\"");
+    
+    fprintf(f, "}");
+}
+
+int dump_csv(FILE * f) {
+    run_dump(f);
+    fprintf(f, "\n");
+    return 1;
+}
+
+int bench_ctx_dump(bench_ctx * c, FILE * f) {
+    struct bench_ctx * prev = bench_ctx_use(c);
+    dump_csv(f);
+    bench_ctx_use(prev);
+    return 1;
+}
+
+int dump_all(FILE * f) {
+    int n = 0;
+    fprintf(f, "{\"out\" : [\n");
+    for(struct bench_ctx * c = contexts; c != NULL; c = c->next) {
+        if(c->samples_size == 0) continue;
+        struct bench_ctx * prev = bench_ctx_use(c);
+        if(n++ > 0) fprintf(f, ",\n");
+        run_dump(f);
+        bench_ctx_use(prev);
+    }
+    fprintf(f, "\n]}\n");
+    return 1;
+}
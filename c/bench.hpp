@@ -0,0 +1,122 @@
+#ifndef BENCH_HPP
+#define BENCH_HPP
+
+/*
+ * Header only C++ front end of bench.h, the engine is still bench.c.
+ * Every type takes a policy: bench::On calls the probes, bench::Off is
+ * empty and inline so an Off build has nothing left in the hot loop.
+ * bench::Default is On unless BENCH_OFF is defined, so one source can
+ * give both builds:
+ *
+ *   for(int y = 0; y < h; y++) {
+ *       bench::ScopedTask<> t(y);
+ *       render_scanline(y);
+ *   }
+ */
+
+#include <type_traits>
+#include "bench.h"
+
+namespace bench {
+
+struct On {
+    static const bool enabled = true;
+    static void task_start(long long tag) { task_start_measure_tag(tag); }
+    static void task_stop() { task_stop_measure(); }
+    static void region_begin(const char * name) { bench_region_begin(name); }
+    static void region_end() { bench_region_end(); }
+    static void start() { process_start_measure(); }
+    static void stop() { process_stop_measure(); }
+};
+
+struct Off {
+    static const bool enabled = false;
+    static void task_start(long long) {}
+    static void task_stop() {}
+    static void region_begin(const char *) {}
+    static void region_end() {}
+    static void start() {}
+    static void stop() {}
+};
+
+#ifdef BENCH_OFF
+typedef Off Default;
+#else
+typedef On Default;
+#endif
+
+/*One task, from construction to the end of the scope*/
+template<class P = Default>
+class ScopedTask {
+public:
+    explicit ScopedTask(long long tag = -1) { P::task_start(tag); }
+    ~ScopedTask() { P::task_stop(); }
+private:
+    ScopedTask(const ScopedTask &);
+    ScopedTask & operator=(const ScopedTask &);
+};
+
+/*A named region, the name is kept so it has to outlive the run*/
+template<class P = Default>
+class ScopedRegion {
+public:
+    explicit ScopedRegion(const char * name) { P::region_begin(name); }
+    ~ScopedRegion() { P::region_end(); }
+private:
+    ScopedRegion(const ScopedRegion &);
+    ScopedRegion & operator=(const ScopedRegion &);
+};
+
+/*Owns a bench_ctx, see bench_ctx_create*/
+class Context {
+public:
+    Context() : c(bench_ctx_create()) {}
+    ~Context() { bench_ctx_destroy(c); }
+    bench_ctx * get() const { return c; }
+    bench_ctx * use() const { return bench_ctx_use(c); }
+private:
+    Context(const Context &);
+    Context & operator=(const Context &);
+    bench_ctx * c;
+};
+
+/*Runs f between process_start_measure and process_stop_measure*/
+template<class P = Default, class F>
+void measure(F && f) {
+    P::start();
+    f();
+    P::stop();
+}
+
+template<class P = Default, class F>
+void task(F && f, long long tag = -1) {
+    ScopedTask<P> t(tag);
+    f();
+}
+
+template<class P = Default, class F>
+void region(const char * name, F && f) {
+    ScopedRegion<P> r(name);
+    f();
+}
+
+template<class F>
+void call(void * f) {
+    (*static_cast<F *>(f))();
+}
+
+/*process_repeat with a lambda, Off still runs it warmup + runs times*/
+template<class P = Default, class F>
+void repeat(int warmup, int runs, F && f) {
+    typedef typename std::remove_reference<F>::type G;
+    if(P::enabled) {
+        process_repeat(warmup, runs, &call<G>, (void *) &f);
+    } else {
+        for(int i = 0; i < warmup + runs; i++)
+            f();
+    }
+}
+
+}
+
+#endif
@@ -1,15 +1,57 @@
 #include <stdio.h>
+#include <string.h>
 #include "bench.h"
 
+static void empty_tasks(void * arg) {
+    for(int i = 0; i < 1000; i++) {
+        task_start_measure();
+        task_stop_measure();
+    }
+}
+
 int main(void) {
     process_init();
     process_name("test");
     process_args(0, NULL);
     process_mode(SEQ);
     process_start_measure();
+    bench_region_begin("tasks");
+    task_init_measure();
+    /*Empty tasks, their sizes are the cost of the probes themselves*/
+    #pragma omp parallel
+    for(int i = 0; i < 1000; i++) {
+        task_start_measure();
+        task_stop_measure();
+    }
+    bench_region_begin("empty");
+    bench_region_end();
+    bench_region_end();
     process_stop_measure();
     process_append_result("Hello", 5);
     process_append_result("Hello2", 6);
-    dump_csv(stdout);
+    /*A second run of the same process in its own context*/
+    bench_ctx * c = bench_ctx_create();
+    bench_ctx_use(c);
+    process_name("test_repeat");
+    process_args(0, NULL);
+    process_mode(SEQ);
+    process_repeat(1, 3, empty_tasks, NULL);
+    /*Only the tasks of the measured runs, not the warmup's*/
+    char out[65536];
+    FILE * f = tmpfile();
+    if(f == NULL) return 1;
+    bench_ctx_dump(c, f);
+    rewind(f);
+    out[fread(out, 1, sizeof(out) - 1, f)] = '\0';
+    fclose(f);
+    if(strstr(out, "\"task_stats\" : {\"count\" : 3000,") == NULL) return 1;
+    /*Its output as a tree hash, parts are refused before process_result_parts and out of range*/
+    if(process_append_part(0, "Hello", 5)) return 1;
+    process_result_parts(2);
+    if(!process_append_part(0, "Hel", 3) || !process_append_part(1, "lo", 2)) return 1;
+    if(process_append_part(2, "!", 1) || process_append_part(-1, "!", 1)) return 1;
+    bench_ctx_use(NULL);
+    dump_all(stdout);
+    bench_ctx_destroy(c);
     return 0;
-}
\ No newline at end of file
+}
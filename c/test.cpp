@@ -0,0 +1,26 @@
+#include <cstdio>
+#include "bench.hpp"
+
+int main() {
+    int sum = 0;
+    process_init();
+    process_name((char *) "test_cpp");
+    process_args(0, NULL);
+    process_mode(SEQ);
+    bench::measure([&] {
+        bench::ScopedRegion<> r("tasks");
+        task_init_measure();
+        for(int i = 0; i < 1000; i++) {
+            bench::ScopedTask<> t(i);
+            sum += i;
+        }
+        /*Compiled out, neither a task nor a region*/
+        for(int i = 0; i < 1000; i++) {
+            bench::ScopedTask<bench::Off> t(i);
+            bench::region<bench::Off>("off", [&] { sum -= i; });
+        }
+    });
+    process_append_result((char *) &sum, sizeof(sum));
+    dump_csv(stdout);
+    return sum != 0;
+}
@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+
+/*
+ * The OMPT tool against LLVM's libomp, which reports a worker's join
+ * barrier and implicit task ends late. Three runs of a 4 thread dynamic
+ * loop must give 12 closed "omp parallel" and "omp barrier wait" calls
+ * on 4 threads, with the children inside their parent. Build with
+ *   gcc -fopenmp -I/usr/lib/llvm-14/lib/clang/14.0.6/include -c bench.c
+ *   gcc -fopenmp test_ompt.c bench.o -L/usr/lib/llvm-14/lib -lomp ...
+ * (or clang -fopenmp), run with BENCH_OMPT=1. Returns 1 on a wrong tree.
+ */
+static volatile double sink;
+
+static void loop(void * arg) {
+    #pragma omp parallel num_threads(4)
+    {
+        #pragma omp for schedule(dynamic, 2)
+        for(int i = 0; i < 64; i++) {
+            double s = 0;
+            for(int k = 0; k < 20000; k++) s += k * 1e-9;
+            sink = s;
+        }
+    }
+}
+
+/*Calls and inclusive ticks of the first region called name, 0 if absent*/
+static int region(const char * out, const char * name, unsigned long long * calls, unsigned long long * inclusive) {
+    char key[64];
+    int threads;
+    snprintf(key, sizeof(key), "{\"name\" : \"%s\",", name);
+    const char * p = strstr(out, key);
+    if(p == NULL) return 0;
+    if(sscanf(p + strlen(key), "\"calls\" : %llu,\"threads\" : %d,\"inclusive\" : %llu", calls, &threads, inclusive) != 3)
+        return 0;
+    return threads;
+}
+
+int main(void) {
+    static char out[1 << 20];
+    unsigned long long calls[3], inclusive[3];
+    const char * names[3] = {"omp parallel", "omp loop", "omp barrier wait"};
+    int bad = 0;
+    process_init();
+    process_name("test_ompt");
+    process_args(0, NULL);
+    process_mode(OPENMP);
+    process_repeat(0, 3, loop, NULL);
+    process_append_result("ompt", 4);
+
+    FILE * f = tmpfile();
+    if(f == NULL) return 1;
+    dump_csv(f);
+    rewind(f);
+    out[fread(out, 1, sizeof(out) - 1, f)] = '\0';
+    fclose(f);
+    for(int i = 0; i < 3; i++) {
+        if(region(out, names[i], &calls[i], &inclusive[i]) != 4) {
+            fprintf(stderr, "test_ompt: no \"%s\" on 4 threads, libomp and BENCH_OMPT=1?\n", names[i]);
+            return 1;
+        }
+    }
+    if(calls[0] != 12 || calls[2] != 12) {
+        fprintf(stderr, "test_ompt: %llu parallel and %llu barrier calls, not 12\n", calls[0], calls[2]);
+        bad = 1;
+    }
+    if(strstr(out, "\"open\"") != NULL) {
+        fprintf(stderr, "test_ompt: regions still open at dump\n");
+        bad = 1;
+    }
+    if(inclusive[1] + inclusive[2] > inclusive[0]) {
+        fprintf(stderr, "test_ompt: loop %llu and barrier %llu ticks in a parallel of %llu\n",
+            inclusive[1], inclusive[2], inclusive[0]);
+        bad = 1;
+    }
+    puts(out);
+    return bad;
+}
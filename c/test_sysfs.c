@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "bench.h"
+
+/*
+ * Energy and throttle accounting against a fake sysfs, through
+ * BENCH_POWERCAP and BENCH_CPU_SYSFS: a package counter that wraps and a
+ * dram one that does not, two cpus whose throttle counters and clocks
+ * move during the measured run. Returns 1 on a wrong figure.
+ */
+static char root[64];
+static char made[32][128];
+static int made_size;
+
+static void put(const char * path, const char * value) {
+    char p[sizeof(made[0])];
+    snprintf(p, sizeof(p), "%s/%s", root, path);
+    FILE * f = fopen(p, "w");
+    if(f == NULL) exit(1);
+    fputs(value, f);
+    fclose(f);
+    for(int i = 0; i < made_size; i++)
+        if(strcmp(made[i], p) == 0) return;
+    snprintf(made[made_size++], sizeof(made[0]), "%s", p);
+}
+
+static void dir(const char * path) {
+    snprintf(made[made_size], sizeof(made[0]), "%s/%s", root, path);
+    if(mkdir(made[made_size++], 0700) != 0) exit(1);
+}
+
+static int expect(const char * out, const char * s) {
+    if(strstr(out, s) != NULL) return 0;
+    fprintf(stderr, "test_sysfs: no %s\n", s);
+    return 1;
+}
+
+int main(void) {
+    char path[128], out[65536];
+    int bad = 0;
+    snprintf(root, sizeof(root), "/tmp/bench_sysfs.XXXXXX");
+    if(mkdtemp(root) == NULL) return 1;
+    dir("powercap");
+    dir("powercap/intel-rapl:0");
+    put("powercap/intel-rapl:0/name", "package-0\n");
+    put("powercap/intel-rapl:0/energy_uj", "999000000\n");
+    put("powercap/intel-rapl:0/max_energy_range_uj", "1000000000\n");
+    dir("powercap/intel-rapl:0:0");
+    put("powercap/intel-rapl:0:0/name", "dram\n");
+    put("powercap/intel-rapl:0:0/energy_uj", "5000000\n");
+    put("powercap/intel-rapl:0:0/max_energy_range_uj", "1000000000\n");
+    dir("cpu");
+    for(int i = 0; i < 2; i++) {
+        snprintf(path, sizeof(path), "cpu/cpu%d", i);
+        dir(path);
+        snprintf(path, sizeof(path), "cpu/cpu%d/thermal_throttle", i);
+        dir(path);
+        snprintf(path, sizeof(path), "cpu/cpu%d/thermal_throttle/core_throttle_count", i);
+        put(path, "3\n");
+        snprintf(path, sizeof(path), "cpu/cpu%d/thermal_throttle/package_throttle_count", i);
+        put(path, "1\n");
+        snprintf(path, sizeof(path), "cpu/cpu%d/cpufreq", i);
+        dir(path);
+        snprintf(path, sizeof(path), "cpu/cpu%d/cpufreq/scaling_cur_freq", i);
+        put(path, "2000000\n");
+    }
+    snprintf(path, sizeof(path), "%s/powercap", root);
+    setenv("BENCH_POWERCAP", path, 1);
+    snprintf(path, sizeof(path), "%s/cpu", root);
+    setenv("BENCH_CPU_SYSFS", path, 1);
+
+    process_init();
+    process_name("test_sysfs");
+    process_args(0, NULL);
+    process_mode(SEQ);
+    process_start_measure();
+    /*The package wraps: 1000 J of range, 999 J before and 1 J after is 2 J*/
+    put("powercap/intel-rapl:0/energy_uj", "1000000\n");
+    put("powercap/intel-rapl:0:0/energy_uj", "8000000\n");
+    put("cpu/cpu0/thermal_throttle/core_throttle_count", "5\n");
+    put("cpu/cpu1/thermal_throttle/package_throttle_count", "2\n");
+    put("cpu/cpu0/cpufreq/scaling_cur_freq", "3000000\n");
+    process_stop_measure();
+    process_append_result("sysfs", 5);
+
+    FILE * f = tmpfile();
+    if(f == NULL) return 1;
+    dump_csv(f);
+    rewind(f);
+    out[fread(out, 1, sizeof(out) - 1, f)] = '\0';
+    fclose(f);
+    bad |= expect(out, "\"name\" : \"package-0\",\"joules\" : 2.000000");
+    bad |= expect(out, "\"name\" : \"package-0/dram\",\"joules\" : 3.000000");
+    bad |= expect(out, "\"throttle\" : {\"core\" : 2,\"package\" : 1}");
+    bad |= expect(out, "\"min_mhz\" : 2000.000000");
+    bad |= expect(out, "\"max_mhz\" : 3000.000000");
+    bad |= expect(out, "\"throttled\" : true");
+
+    while(made_size > 0) remove(made[--made_size]);
+    rmdir(root);
+    puts(out);
+    return bad;
+}
@@ -36,6 +36,9 @@ help:
     display this message
 run:
     run the project and measure the results
+    progress, throughput and ETA of each benchmark process are shown
+    while it runs, with "time_limit" (seconds) in the bench file a
+    process past it, or projected past it, is killed and the run fails
 
 offset path is done via the BENCH_STDPATH, eg:
 BENCH_STDPATH=../foo/ bench build
@@ -138,12 +141,13 @@ author id is set via the BENCH_STDID, otherwise, ANON will be used.
             if v["build"] != true {
                 std::process::exit(1);
             }
+            let limit = v["time_limit"].as_f64();
             match v["run_cmd"] {
                 serde_json::Value::String(ref q) => {
                     match v["run_arg"] {
                         serde_json::Value::String(ref v) => {
                             let out: String;
-                            out = String::from(std::str::from_utf8(&std::process::Command::new(q).arg(v).arg("-s").current_dir(&path).output().expect("Err: could not run benchmark").stdout).expect("Err: could not read output"));
+                            out = run_live(std::process::Command::new(q).arg(v).arg("-s").current_dir(&path), limit);
                             let mut q: serde_json::Value = serde_json::from_str(out.as_str()).expect("Err: parsing benchmark output");
                             match q["out"] {
                                 serde_json::Value::Array(ref mut r) => {
@@ -184,9 +188,17 @@ author id is set via the BENCH_STDID, otherwise, ANON will be used.
                     for i in r {
                         match i {
                             serde_json::Value::Object(ref s) => {
+                                /*Runs with a task histogram already carry statistics over every task*/
+                                match s.get("task_stats") {
+                                    Some(&serde_json::Value::Object(ref t)) => {
+                                        println!("{},{},{},{},{},\"{}\",{},{},{},{}", s["bench"], s["id"], s["args"], s["mode"], hardware, s["time"], t["mean"], t["p50"], t["stddev"], s["output"]);
+                                        continue;
+                                    }
+                                    _ => { }
+                                }
+                                let mut values = Vec::new();
                                 match s["tasks"] {
                                     serde_json::Value::Array(ref tasks) => {
-                                        let mut values = Vec::new();
                                         for num in tasks {
                                             match num {
                                                 serde_json::Value::Number(n) => {
@@ -201,20 +213,25 @@ author id is set via the BENCH_STDID, otherwise, ANON will be used.
                                                 _ => { }
                                             }
                                         }
-                                        /*Generate statistics*/
-                                        if values.len() > 0 {
-                                            let mean = statistical::mean(&values);
-                                            let median = statistical::median(&values);
-                                            let dev = statistical::standard_deviation(&values, Some(mean));
-                                            println!("{},{},{},{},{},\"{}\",{},{},{},{}", s["bench"], s["id"], s["args"], s["mode"], hardware, s["time"], mean, median, dev, s["output"]);
-                                        } else {
-                                            println!("{},{},{},{},{},{},_,_,_,{}", s["bench"], s["id"], s["args"], s["mode"], hardware, s["time"], s["output"]);
-                                        }
                                     }
                                     _ => {
-                                        println!("{},{},{},{},{},{},_,_,_,{}", s["bench"], s["id"], s["args"], s["mode"], hardware, s["time"], s["output"]);
+                                        match s.get("trace").map(|t| &t["path"]) {
+                                            Some(&serde_json::Value::String(ref t)) => {
+                                                values = read_trace(std::path::Path::new(path.as_str()).join(t).as_path());
+                                            }
+                                            _ => { }
+                                        }
                                     }
                                 }
+                                /*Generate statistics*/
+                                if values.len() > 0 {
+                                    let mean = statistical::mean(&values);
+                                    let median = statistical::median(&values);
+                                    let dev = statistical::standard_deviation(&values, Some(mean));
+                                    println!("{},{},{},{},{},\"{}\",{},{},{},{}", s["bench"], s["id"], s["args"], s["mode"], hardware, s["time"], mean, median, dev, s["output"]);
+                                } else {
+                                    println!("{},{},{},{},{},{},_,_,_,{}", s["bench"], s["id"], s["args"], s["mode"], hardware, s["time"], s["output"]);
+                                }
                             }
                             _ => { panic!("Err: parsing benchmark output"); }
                         }
@@ -255,4 +272,150 @@ fn force_write(path: String) -> std::fs::File {
         Ok(_) => std::fs::File::create(&path).expect("Err: could not create file"),
         Err(_) => std::fs::File::create(&path).expect("Err: could not create file")
     }
-}
\ No newline at end of file
+}
+
+/*Task durations of a binary trace written by the bench API, see c/bench.c*/
+fn read_trace(path: &std::path::Path) -> Vec<f64> {
+    let mut values = Vec::new();
+    let data = match std::fs::read(path) {
+        Ok(d) => d,
+        Err(_) => { return values; }
+    };
+    let u64_at = |o: usize| -> Option<u64> {
+        if o + 8 > data.len() { return None; }
+        let mut b = [0u8; 8];
+        b.copy_from_slice(&data[o..o + 8]);
+        Some(u64::from_le_bytes(b))
+    };
+    if data.len() < 32 || &data[0..8] != b"BNCHTRC1" {
+        return values;
+    }
+    /*Version 1 records are (start, duration), version 2 adds (tag, cpu)*/
+    let record = if u64_at(8) == Some(1) { 16 } else { 32 };
+    let threads = u64_at(16).unwrap_or(0) as usize;
+    for i in 0..threads {
+        let count = u64_at(32 + 24 * i + 8).unwrap_or(0) as usize;
+        let offset = u64_at(32 + 24 * i + 16).unwrap_or(0) as usize;
+        for j in 0..count {
+            match u64_at(offset + record * j + 8) {
+                Some(d) => { values.push(d as f64); }
+                None => { break; }
+            }
+        }
+    }
+    values
+}
+
+/*Live counters of the running benchmark process, see BENCH_LIVE in c/bench.c*/
+struct Live {
+    pid: u64,
+    phase: u64,
+    expected: u64,
+    runs: u64,
+    runs_done: u64,
+    tasks: u64,
+    elapsed: f64 /*Seconds from the library load to the last task end*/
+}
+
+fn read_live(path: &std::path::Path) -> Option<Live> {
+    let data = match std::fs::read(path) {
+        Ok(d) => d,
+        Err(_) => { return None; }
+    };
+    let u64_at = |o: usize| -> u64 {
+        let mut b = [0u8; 8];
+        b.copy_from_slice(&data[o..o + 8]);
+        u64::from_ne_bytes(b)
+    };
+    if data.len() < 128 || &data[0..8] != b"BNCHLIV1" {
+        return None;
+    }
+    /*128 bytes of header, then 64 bytes per thread*/
+    let threads = std::cmp::min(u64_at(64) as usize, (data.len() - 128) / 64);
+    let mut tasks = 0;
+    let mut end = 0;
+    for i in 0..threads {
+        tasks += u64_at(128 + 64 * i);
+        end = std::cmp::max(end, u64_at(128 + 64 * i + 16));
+    }
+    let ticks_per_ns = f64::from_bits(u64_at(16));
+    let elapsed = if end > u64_at(24) && ticks_per_ns > 0.0 { (end - u64_at(24)) as f64 / ticks_per_ns * 1e-9 } else { 0.0 };
+    Some(Live { pid: u64_at(8), phase: u64_at(32), expected: u64_at(40), runs: u64_at(48), runs_done: u64_at(56), tasks: tasks, elapsed: elapsed })
+}
+
+/*
+ * Runs the benchmark with BENCH_LIVE set and polls its counters every
+ * half a second. Each benchmark process is timed on its own, one past
+ * limit, or projected past it once a tenth of it is done, is killed.
+ */
+fn run_live(cmd: &mut std::process::Command, limit: Option<f64>) -> String {
+    let phases = ["startup", "load", "compute", "output", "verify"];
+    let name = format!("bench-{}", std::process::id());
+    let shm = std::path::Path::new("/dev/shm").join(&name);
+    let mut child = cmd.env("BENCH_LIVE", format!("/{}", name)).stdout(std::process::Stdio::piped()).spawn().expect("Err: could not run benchmark");
+    let mut stdout = child.stdout.take().expect("Err: could not read output");
+    let reader = std::thread::spawn(move || {
+        let mut out = String::new();
+        stdout.read_to_string(&mut out).expect("Err: could not read output");
+        out
+    });
+    let mut pid = 0;
+    let mut start = std::time::Instant::now();
+    let mut last = (start, 0);
+    let mut shown = false;
+    loop {
+        match child.try_wait().expect("Err: could not run benchmark") {
+            Some(_) => { break; }
+            None => { }
+        }
+        std::thread::sleep(std::time::Duration::from_millis(500));
+        let l = match read_live(&shm) {
+            Some(l) => l,
+            None => { continue; }
+        };
+        let now = std::time::Instant::now();
+        if l.pid != pid {
+            /*It may have been running for a while already*/
+            pid = l.pid;
+            start = now - std::time::Duration::from_secs_f64(l.elapsed);
+            last = (now, l.tasks);
+        }
+        let elapsed = now.duration_since(start).as_secs_f64();
+        let dt = now.duration_since(last.0).as_secs_f64();
+        let rate = if dt > 0.0 { l.tasks.saturating_sub(last.1) as f64 / dt } else { 0.0 };
+        last = (now, l.tasks);
+        let phase = if (l.phase as usize) < phases.len() { phases[l.phase as usize] } else { "-" };
+        /*Tasks when their count is known, else whole runs of process_repeat*/
+        let total = l.expected * std::cmp::max(l.runs, 1);
+        let done = if total > 0 && l.tasks > 0 {
+            f64::min(l.tasks as f64 / total as f64, 1.0)
+        } else if l.runs > 1 {
+            l.runs_done as f64 / l.runs as f64
+        } else {
+            0.0
+        };
+        let runs = if l.runs > 1 { format!(", run {}/{}", l.runs_done, l.runs) } else { String::new() };
+        if done > 0.0 {
+            eprint!("\r{} {}: {} tasks, {:.1} tasks/s{}, {:.1}%, {:.0}s, ETA {:.0}s   ", pid, phase, l.tasks, rate, runs, done * 100.0, elapsed, elapsed * (1.0 - done) / done);
+        } else {
+            eprint!("\r{} {}: {} tasks, {:.1} tasks/s{}, {:.0}s   ", pid, phase, l.tasks, rate, runs, elapsed);
+        }
+        shown = true;
+        match limit {
+            Some(t) => {
+                if elapsed > t || (done >= 0.1 && elapsed / done > t) {
+                    eprintln!("\nErr: process {} out of its time envelope ({:.0}s, limit {:.0}s), aborting", pid, if done > 0.0 { elapsed / done } else { elapsed }, t);
+                    let _ = std::process::Command::new("kill").arg(pid.to_string()).status();
+                    let _ = child.kill();
+                    let _ = child.wait();
+                    let _ = std::fs::remove_file(&shm);
+                    std::process::exit(1);
+                }
+            }
+            None => { }
+        }
+    }
+    if shown { eprintln!(""); }
+    let _ = std::fs::remove_file(&shm);
+    reader.join().expect("Err: could not read output")
+}
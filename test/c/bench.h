@@ -3,35 +3,220 @@
 
 #include <stdio.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 enum Bench_mode {
     SEQ = 0,
     OPENMP,
-    OMPSS,
     PTHREADS,
     OPTMIZED,
     CUDA,
-    OPENMP_TASK
+    OPENMP_TASK,
+    OMPSS,
+    OMPSS2
 };
 
+enum Bench_phase {
+    PHASE_STARTUP = 0,
+    PHASE_LOAD,
+    PHASE_COMPUTE,
+    PHASE_OUTPUT,
+    PHASE_VERIFY
+};
+
+/*
+ * A context holds one run: name, mode, args, samples, output digest,
+ * tasks and regions. Every call below works on the current context,
+ * which is a default one until bench_ctx_use selects another, so a
+ * program with a single run never needs them. Several kernels or
+ * configurations can run back to back in one process, each in its own
+ * context, and dump_all prints them as one {"out" : [...]}.
+ * Create, switch and destroy contexts while no task is being timed.
+ * Paths from BENCH_TRACE, BENCH_TIMELINE and BENCH_PROFILE get a .<n>
+ * suffix in created contexts.
+ */
+typedef struct bench_ctx bench_ctx;
+
+bench_ctx * bench_ctx_create(void);
+bench_ctx * bench_ctx_use(bench_ctx * c); /*NULL is the default context, returns the previous one*/
+void bench_ctx_destroy(bench_ctx * c);
+int bench_ctx_dump(bench_ctx * c, FILE * f);
+
 void process_init();
 
 void process_name(char * str);
 void process_mode(enum Bench_mode mode);
 int process_args(int argc, char **argv);
 
+/*
+ * The output is hashed as it is appended, nothing is kept around.
+ * With process_result_parts(n) the hash becomes a tree: each part
+ * 0..n-1 is a leaf that may be fed from its own thread (e.g. one per
+ * scanline range) and the reported digest is the SHA256 of the leaf
+ * digests in order, preceded by the digest of process_append_result
+ * data if there was any. The c-ray variants hash their image this way,
+ * one part per block of 16 scanlines, so every variant and thread count
+ * gives the same digest.
+ */
 void process_append_result(char * str, int size);
+void process_append_file(char * str);
+int process_result_parts(int n);
+int process_append_part(int part, char * str, int size); /*0 without parts or with part out of range*/
 
+/*
+ * With BENCH_PERF=1 in the environment, Linux hardware counters (cycles,
+ * instructions, LLC misses, branch misses, stalled cycles) are read
+ * here and around every task, and reported as "counters" and
+ * "task_counters", both summed over the samples like "resources" and
+ * "energy". Only registered threads are counted. Counts of groups the
+ * kernel multiplexed are scaled by enabled/running time, and the object
+ * then has "scaled" : true.
+ * Page faults, context switches and user/system time (getrusage) are
+ * always taken here too, with the resident set size at the end, and
+ * reported as "resources".
+ * When the RAPL energy counters of /sys/class/powercap (or of the tree
+ * BENCH_POWERCAP points to) are readable, joules and average watts per
+ * package and domain are reported as "energy".
+ * "frequency" has the base clock, the cpufreq clocks and thermal throttle
+ * events of the cpus (sysfs, or the tree BENCH_CPU_SYSFS points to) and,
+ * with BENCH_PERF=1, the GHz each registered thread ran at, from cycles
+ * against ref-cycles or its task clock. "throttled" is true when
+ * throttle events happened or a thread ran below 90% of the base clock.
+ */
 int process_stop_measure(void);
 int process_start_measure(void);
 
-#ifdef _OPENMP
+/*
+ * Runs kernel(arg) warmup times unmeasured, then runs times between
+ * process_start_measure and process_stop_measure. The tasks of the
+ * warmup runs are dropped. When a process holds
+ * more than one sample, every one of them is printed with min, median,
+ * mean, standard deviation and coefficient of variation, and "time" is
+ * the median.
+ */
+int process_repeat(int warmup, int runs, void (*kernel)(void *), void * arg);
 
+/*
+ * Wall time of the whole program split in fixed phases, reported as
+ * "phases" with all of them present. process_phase ends the current
+ * phase and starts the given one, entering a phase again adds to it.
+ * The default context is in PHASE_STARTUP from the moment the library
+ * is loaded, process_phase_end stops the clock (dump_csv does too).
+ * Startup is setup of the program: arguments, buffers, threads. Load
+ * reads the input, compute is the work process_start_measure times,
+ * output writes the result and verify digests it.
+ */
+int process_phase(enum Bench_phase phase);
+int process_phase_end(void);
+
+/*
+ * With BENCH_LIVE=/name in the environment (bench run sets it) the run
+ * publishes live counters in that POSIX shared memory segment: current
+ * phase, runs done out of those process_repeat plans, and tasks, busy
+ * ticks and last task end per thread (layout in bench.c). The expected
+ * tasks of one run, if given here, let a monitor show progress and ETA.
+ */
+int process_progress_total(unsigned long long tasks);
+
+/*
+ * Task timing works from any thread (OpenMP, pthreads, std::thread...),
+ * each one gets its own recorder on its first task. Workers may call
+ * task_register_thread() before the measured region to move that
+ * allocation out of it, it returns the thread index used in the output.
+ * Every thread times a few hundred empty tasks when it registers, and
+ * task_init_measure repeats it for the calling thread. That cost of the
+ * probes is reported as "overhead" and taken off the task sizes in
+ * "task_stats_corrected", "task_stats" keeps the raw ones.
+ * Each thread's busy time (sum of its tasks) and idle time (the rest up
+ * to its last task end) in the last measured sample are reported with
+ * the imbalance of the busy times as "imbalance".
+ */
+/*
+ * process_trace(path), or BENCH_TRACE=path, writes the tasks to a binary
+ * trace (layout in bench.c) and the JSON only references it by path and
+ * SHA256, instead of listing every task.
+ */
+int process_trace(char * path);
+/*
+ * process_timeline(path), or BENCH_TIMELINE=path, also writes every
+ * remembered task as a Chrome/Perfetto trace: start, duration, thread,
+ * cpu and tag.
+ */
+int process_timeline(char * path);
+/*
+ * process_profile(path), or BENCH_PROFILE=path, samples every registered
+ * thread with SIGPROF while the run is measured and writes collapsed
+ * stacks for flame graphs. BENCH_PROFILE_HZ sets the rate (997) and
+ * BENCH_PROFILE_DEPTH=n keeps n frames, which needs code built with
+ * -fno-omit-frame-pointer. Link with -rdynamic to get function names.
+ * Call it before the threads register: the others already registered
+ * are not sampled and counted as "unsampled".
+ */
+int process_profile(char * path);
 int task_init_measure(void);
+int task_register_thread(void);
 int task_stop_measure(void);
 int task_start_measure(void);
+int task_start_measure_tag(long long tag); /*e.g. the scanline index*/
+
+/*
+ * Figures of merit besides the time, reported under "metrics".
+ * process_add_metric adds value to a named metric of the run.
+ * task_add_count adds n to a counter of the calling thread, the threads
+ * are summed at dump_csv and reported with their rate over the measured
+ * time; counts given outside the measured region are dropped. Keep the
+ * hot path on a thread local variable and hand it over once per task or
+ * thread. Names are kept, at most 16 of each.
+ */
+int process_add_metric(const char * name, double value, const char * unit);
+int task_add_count(const char * name, unsigned long long n);
+
+/*
+ * Building bench.c with -DBENCH_ALLOC (e.g. make G=-DBENCH_ALLOC build)
+ * wraps malloc, calloc, realloc, the aligned allocators and free for the
+ * whole program. The run then reports "allocations": calls, frees, bytes
+ * and ticks spent in the allocator per thread, inside the measured
+ * region and per region.
+ */
 
+/*
+ * Building bench.c with -DBENCH_LOCKS (Linux, link with -ldl before glibc
+ * 2.34) wraps pthread_mutex_lock, pthread_mutex_unlock, pthread_cond_wait
+ * and pthread_barrier_wait for the whole program. Every lock and call
+ * site pair counts acquisitions, contended ones, ticks waited and ticks
+ * held, and "locks" lists the ten that waited longest over the whole
+ * program. Link with -rdynamic to get names instead of offsets.
+ */
+
+/*
+ * Named regions nest per thread, e.g. bench_region_begin("render") ...
+ * bench_region_end(). Each one reports its call count and its inclusive
+ * and exclusive ticks, summed over the threads that entered it.
+ * Build with -DBENCH_NO_REGIONS to compile them out.
+ */
+/*
+ * OpenMP programs built with clang and libomp get an OMPT tool in the
+ * -fopenmp object. With BENCH_OMPT=1 it records, without any probe in
+ * the source, "omp parallel" and work-sharing regions with their
+ * barrier waits, plus one task per dispatched chunk or explicit task.
+ * libomp 14 never reports chunks, its loops are one task per thread.
+ * c/test_ompt.c checks the tree against the system libomp.
+ */
+#ifndef BENCH_NO_REGIONS
+int bench_region_begin(const char * name);
+int bench_region_end(void);
+#else
+#define bench_region_begin(name) (1)
+#define bench_region_end() (1)
 #endif
 
 int dump_csv(FILE * f); /*Usually STDOUT*/
+int dump_all(FILE * f); /*Every context with a measurement*/
+
+#ifdef __cplusplus
+}
+#endif
 
-#endif
\ No newline at end of file
+#endif
@@ -64,6 +64,7 @@ struct thread_data {
 	uint32_t *pixels;
 };
 
+void render_frame(void *fb);
 void render_scanline(int sl, uint32_t *fb);
 struct vec3 trace(struct ray ray, int depth);
 struct vec3 shade(struct sphere *obj, struct spoint *sp, int depth);
@@ -74,6 +75,9 @@ struct vec3 get_sample_pos(int x, int y, int sample);
 struct vec3 jitter(int x, int y, int s);
 int ray_sphere(const struct sphere *sph, struct ray ray, struct spoint *sp);
 void load_scene(FILE *fp);
+void count_rays(void);
+void hash_image(uint32_t *pixels);
+void hash_block(uint32_t *pixels, int block);
 
 #define MAX_LIGHTS		16				/* maximum number of lights */
 #define RAY_MAG			1000.0			/* trace rays of this magnitude */
@@ -112,11 +116,15 @@ struct vec3 lights[MAX_LIGHTS];
 int lnum = 0;
 struct camera cam;
 
+#define HASH_LINES	16	/* scanlines per part of the output digest */
 #define NRAN	1024
 #define MASK	(NRAN - 1)
 struct vec3 urand[NRAN];
 int irand[NRAN];
 
+/* rays traced, shadow rays and ray-sphere tests of this thread, see count_rays */
+static __thread unsigned long long ray_count, shadow_count, test_count;
+
 const char usage[] = {
 	"Usage: c-ray-mt [options]\n"
 	"  Reads a scene file from stdin, writes the image to stdout, and stats to stderr.\n\n"
@@ -127,6 +135,8 @@ const char usage[] = {
 	"  -o <file>  write to <file> instead of stdout\n"
 	"  -t <N>     specify thread count\n"
 	"  -n		  do not write output\n"
+	"  -R <runs>  render <runs> measured frames (default: 1)\n"
+	"  -W <runs>  render <runs> warmup frames first (default: 0)\n"
 	"  -h         this help screen\n\n"
 };
 
@@ -134,11 +144,12 @@ const char usage[] = {
 
 int main(int argc, char **argv, char **envp) {
 
+	process_init();
     process_name("c-ray-mt");
     process_mode(OPENMP);
     process_args(argc, argv);
 
-	int i, noout = 0;
+	int i, noout = 0, runs = 1, warmup = 0;
 	unsigned long rend_time, start_time;
 	uint32_t *pixels;
 	FILE *infile = stdin, *outfile = stdout;
@@ -176,6 +187,21 @@ int main(int argc, char **argv, char **envp) {
 				noout = 1;
 				break;
 
+			case 'R':
+				if(!isdigit(argv[++i][0]) || !(runs = atoi(argv[i]))) {
+					fputs("-R must be followed by a positive number (measured frames)\n", stderr);
+					return EXIT_FAILURE;
+				}
+				break;
+
+			case 'W':
+				if(!isdigit(argv[++i][0])) {
+					fputs("-W must be followed by a number (warmup frames)\n", stderr);
+					return EXIT_FAILURE;
+				}
+				warmup = atoi(argv[i]);
+				break;
+
 			case 'r':
 				if(!isdigit(argv[++i][0])) {
 					fputs("-r must be followed by a number (rays per pixel)\n", stderr);
@@ -211,39 +237,32 @@ int main(int argc, char **argv, char **envp) {
 		perror("pixel buffer allocation failed");
 		return EXIT_FAILURE;
 	}
+	process_phase(PHASE_LOAD);
+	bench_region_begin("load_scene");
 	load_scene(infile);
+	bench_region_end();
 
 	/* initialize the random number tables for the jitter */
 	for(i=0; i<NRAN; i++) urand[i].x = (double)rand() / RAND_MAX - 0.5;
 	for(i=0; i<NRAN; i++) urand[i].y = (double)rand() / RAND_MAX - 0.5;
 	for(i=0; i<NRAN; i++) irand[i] = (int)(NRAN * ((double)rand() / RAND_MAX));
-	
-    int id;
-    #pragma omp parallel shared(xres, yres, pixels, rays_per_pixel, aspect, lnum, obj_list, cam, lights, urand, irand) private(i, id)
-    {
-        #pragma omp barrier
-		#pragma omp single
-		#ifdef _OPENMP
-			task_init_measure();
-		#endif
-			process_start_measure();
 
-        #pragma omp for schedule(dynamic)
-        for(i = 0; i < yres; i++) {
-			#ifdef _OPENMP
-				task_start_measure();
-			#endif
-            render_scanline(i, (uint32_t*)((void*)pixels + i*xres*sizeof(uint32_t)));
-			#ifdef _OPENMP
-				task_stop_measure();
-			#endif
-        }
-    }
+	/* start the thread team here, not in the first frame */
+	process_phase(PHASE_STARTUP);
+#pragma omp parallel
+	{
+	}
 	
-	/* output statistics to stderr */
-	process_stop_measure();
-
+	process_phase(PHASE_COMPUTE);
+	process_progress_total(yres); /* one task per scanline */
+	bench_region_begin("render");
+	task_init_measure();
+	process_repeat(warmup, runs, render_frame, pixels);
+	bench_region_end();
+
+	process_phase(PHASE_OUTPUT);
 	if(!noout) {
+	bench_region_begin("output");
 	/* output the image */
 		fprintf(outfile, "P6\n%d %d\n255\n", xres, yres);
 		for(i=0; i<xres * yres; i++) {
@@ -252,9 +271,13 @@ int main(int argc, char **argv, char **envp) {
 			fputc((pixels[i] >> BSHIFT) & 0xff, outfile);
 		}
 		fflush(outfile);
+		if(outfile != stdout) fclose(outfile);
+	bench_region_end();
 	}
+	process_phase(PHASE_VERIFY);
+	hash_image(pixels);
+	process_phase_end();
 	if(infile != stdin) fclose(infile);
-	if(outfile != stdout) fclose(outfile);
 	struct sphere *walker = obj_list;
 	while(walker) {
 		struct sphere *tmp = walker;
@@ -266,6 +289,27 @@ int main(int argc, char **argv, char **envp) {
 	return 0;
 }
 
+/* render a whole frame, the unit measured by process_repeat */
+void render_frame(void *fb) {
+	uint32_t *pixels = fb;
+	int i;
+
+    #pragma omp parallel shared(xres, yres, pixels, rays_per_pixel, aspect, lnum, obj_list, cam, lights, urand, irand) private(i)
+    {
+        #pragma omp for schedule(dynamic)
+        for(i = 0; i < yres; i++) {
+			#ifdef _OPENMP
+				task_start_measure_tag(i);
+			#endif
+            render_scanline(i, (uint32_t*)((void*)pixels + i*xres*sizeof(uint32_t)));
+			#ifdef _OPENMP
+				task_stop_measure();
+			#endif
+        }
+        count_rays();
+    }
+}
+
 /* render a frame of xsz/ysz dimensions into the provided framebuffer */
 void render_scanline(int sl, uint32_t *fb) {
 	int i, s;
@@ -293,6 +337,51 @@ void render_scanline(int sl, uint32_t *fb) {
 	}
 }
 
+/* hand the counts of the calling thread over to the bench API, once it is done rendering */
+void count_rays(void) {
+	task_add_count("rays", ray_count + shadow_count);
+	task_add_count("shadow_rays", shadow_count);
+	task_add_count("intersections", test_count);
+	ray_count = shadow_count = test_count = 0;
+}
+
+/* hash one block of HASH_LINES scanlines, as their PPM bytes, into its own part */
+void hash_block(uint32_t *pixels, int block) {
+	int i, j;
+	unsigned char *row;
+
+	if(!(row = malloc(xres * 3))) {
+		perror("row buffer allocation failed");
+		exit(EXIT_FAILURE);
+	}
+	for(j=block * HASH_LINES; j<yres && j<(block + 1) * HASH_LINES; j++) {
+		uint32_t *line = pixels + j * xres;
+		for(i=0; i<xres; i++) {
+			row[i * 3] = (line[i] >> RSHIFT) & 0xff;
+			row[i * 3 + 1] = (line[i] >> GSHIFT) & 0xff;
+			row[i * 3 + 2] = (line[i] >> BSHIFT) & 0xff;
+		}
+		process_append_part(block, (char *)row, xres * 3);
+	}
+	free(row);
+}
+
+/* digest the image as a tree: the PPM header, then one part per block of
+ * HASH_LINES scanlines, the same digest whatever hashes the blocks
+ */
+void hash_image(uint32_t *pixels) {
+	int i, n, blocks = (yres + HASH_LINES - 1) / HASH_LINES;
+	char header[64];
+
+	n = sprintf(header, "P6\n%d %d\n255\n", xres, yres);
+	process_append_result(header, n);
+	process_result_parts(blocks);
+#pragma omp parallel for schedule(dynamic)
+	for(i=0; i<blocks; i++) {
+		hash_block(pixels, i);
+	}
+}
+
 /* trace a ray throught the scene recursively (the recursion happens through
  * shade() to calculate reflection rays if necessary).
  */
@@ -307,6 +396,7 @@ struct vec3 trace(struct ray ray, int depth) {
 		col.x = col.y = col.z = 0.0;
 		return col;
 	}
+	ray_count++;
 
 	/* find the nearest intersection ... */
 	while(iter) {
@@ -352,6 +442,7 @@ struct vec3 shade(struct sphere *obj, struct spoint *sp, int depth) {
 		shadow_ray.dir = ldir;
 
 		/* shoot shadow rays to determine if we have a line of sight with the light */
+		shadow_count++;
 		while(iter) {
 			if(ray_sphere(iter, shadow_ray, 0)) {
 				in_shadow = 1;
@@ -491,6 +582,8 @@ struct vec3 jitter(int x, int y, int s) {
 int ray_sphere(const struct sphere *sph, struct ray ray, struct spoint *sp) {
 	double a, b, c, d, sqrt_d, t1, t2;
 
+	test_count++;
+
 	a = SQ(ray.dir.x) + SQ(ray.dir.y) + SQ(ray.dir.z);
 	b = 2.0 * ray.dir.x * (ray.orig.x - sph->pos.x) +
 				2.0 * ray.dir.y * (ray.orig.y - sph->pos.y) +
@@ -91,6 +91,13 @@ struct thread_data {
 	uint32_t *pixels;
 };
 
+struct hash_data {
+	pthread_t tid;
+	int first;
+
+	uint32_t *pixels;
+};
+
 void render_scanline(int xsz, int ysz, int sl, uint32_t *fb, int samples);
 struct vec3 trace(struct ray ray, int depth);
 struct vec3 shade(struct sphere *obj, struct spoint *sp, int depth);
@@ -101,6 +108,10 @@ struct vec3 get_sample_pos(int x, int y, int sample);
 struct vec3 jitter(int x, int y, int s);
 int ray_sphere(const struct sphere *sph, struct ray ray, struct spoint *sp);
 void load_scene(FILE *fp);
+void count_rays(void);
+void hash_image(uint32_t *pixels);
+void hash_block(uint32_t *pixels, int block);
+void *hash_func(void *arg);
 unsigned long get_msec(void);
 
 void *thread_func(void *tdata);
@@ -151,15 +162,20 @@ int pinning = 0;
 int cur = 0;
 
 volatile int start = 0;
+int registered = 0;	/* workers done with task_register_thread, main waits for all of them */
 pthread_mutex_t start_mutex = PTHREAD_MUTEX_INITIALIZER;
 pthread_cond_t start_cond = PTHREAD_COND_INITIALIZER;
 pthread_mutex_t line_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+#define HASH_LINES	16	/* scanlines per part of the output digest */
 #define NRAN	1024
 #define MASK	(NRAN - 1)
 struct vec3 urand[NRAN];
 int irand[NRAN];
 
+/* rays traced, shadow rays and ray-sphere tests of this thread, see count_rays */
+static __thread unsigned long long ray_count, shadow_count, test_count;
+
 const char *usage = {
 	"Usage: c-ray-mt [options]\n"
 	"  Reads a scene file from stdin, writes the image to stdout, and stats to stderr.\n\n"
@@ -177,6 +193,7 @@ const char *usage = {
 
 int main(int argc, char **argv) {
 
+	process_init();
     process_name("c-ray-mt");
     process_mode(OPTMIZED);
     process_args(argc, argv);
@@ -268,13 +285,18 @@ int main(int argc, char **argv) {
 		perror("pixel buffer allocation failed");
 		return EXIT_FAILURE;
 	}
+	process_phase(PHASE_LOAD);
+	bench_region_begin("load_scene");
 	load_scene(infile);
+	bench_region_end();
 
 	/* initialize the random number tables for the jitter */
 	for(i=0; i<NRAN; i++) urand[i].x = (double)rand() / RAND_MAX - 0.5;
 	for(i=0; i<NRAN; i++) urand[i].y = (double)rand() / RAND_MAX - 0.5;
 	for(i=0; i<NRAN; i++) irand[i] = (int)(NRAN * ((double)rand() / RAND_MAX));
 
+	process_phase(PHASE_STARTUP);
+
 	if(thread_num > yres) {
 		fprintf(stderr, "more threads than scanlines specified, reducing number of threads to %d\n", yres);
 		thread_num = yres;
@@ -306,7 +328,15 @@ int main(int argc, char **argv) {
 	threads[thread_num - 1].sl_count = yres - threads[thread_num - 1].sl_start;
 
 
+	process_phase(PHASE_COMPUTE);
+	process_progress_total(yres); /* one task per scanline */
+	bench_region_begin("render");
 	pthread_mutex_lock(&start_mutex);
+	/* no worker may still be calibrating its probes once the clock starts */
+	while(registered < thread_num) {
+		pthread_cond_wait(&start_cond, &start_mutex);
+	}
+	task_init_measure();
 	process_start_measure();
 	start = 1;
 	pthread_cond_broadcast(&start_cond);
@@ -316,9 +346,12 @@ int main(int argc, char **argv) {
 		pthread_join(threads[i].thread, 0);
 	}
 	process_stop_measure();
+	bench_region_end();
 
 
+	process_phase(PHASE_OUTPUT);
 	/* output the image */
+	bench_region_begin("output");
 	fprintf(outfile, "P6\n%d %d\n255\n", xres, yres);
 	for(i=0; i<xres * yres; i++) {
 		fputc((pixels[i] >> RSHIFT) & 0xff, outfile);
@@ -326,9 +359,13 @@ int main(int argc, char **argv) {
 		fputc((pixels[i] >> BSHIFT) & 0xff, outfile);
 	}
 	fflush(outfile);
+	if(outfile != stdout) fclose(outfile);
+	bench_region_end();
+	process_phase(PHASE_VERIFY);
+	hash_image(pixels);
+	process_phase_end();
 
 	if(infile != stdin) fclose(infile);
-	if(outfile != stdout) fclose(outfile);
 
 	struct sphere *walker = obj_list;
 	while(walker) {
@@ -387,7 +424,10 @@ void *thread_func(void *tdata) {
       }
     }
 
+    task_register_thread();
     pthread_mutex_lock(&start_mutex);
+    registered++;
+    pthread_cond_broadcast(&start_cond);
     while(!start){
         pthread_cond_wait(&start_cond, &start_mutex);
     }
@@ -405,9 +445,13 @@ void *thread_func(void *tdata) {
         else
             block_end = block_start + THREAD_BLOCK;
 
-        for(i = block_start; i < block_end; i++)
+        for(i = block_start; i < block_end; i++) {
+            task_start_measure_tag(i);
             render_scanline(xres, yres, i, td->pixels, rays_per_pixel);
+            task_stop_measure();
+        }
     }
+    count_rays();
 
     return 0;
 }
@@ -438,6 +482,76 @@ void render_scanline(int xsz, int ysz, int sl, uint32_t *fb, int samples) {
 	}
 }
 
+/* hand the counts of the calling thread over to the bench API, once it is done rendering */
+void count_rays(void) {
+	task_add_count("rays", ray_count + shadow_count);
+	task_add_count("shadow_rays", shadow_count);
+	task_add_count("intersections", test_count);
+	ray_count = shadow_count = test_count = 0;
+}
+
+/* hash one block of HASH_LINES scanlines, as their PPM bytes, into its own part */
+void hash_block(uint32_t *pixels, int block) {
+	int i, j;
+	unsigned char *row;
+
+	if(!(row = malloc(xres * 3))) {
+		perror("row buffer allocation failed");
+		exit(EXIT_FAILURE);
+	}
+	for(j=block * HASH_LINES; j<yres && j<(block + 1) * HASH_LINES; j++) {
+		uint32_t *line = pixels + j * xres;
+		for(i=0; i<xres; i++) {
+			row[i * 3] = (line[i] >> RSHIFT) & 0xff;
+			row[i * 3 + 1] = (line[i] >> GSHIFT) & 0xff;
+			row[i * 3 + 2] = (line[i] >> BSHIFT) & 0xff;
+		}
+		process_append_part(block, (char *)row, xres * 3);
+	}
+	free(row);
+}
+
+/* digest the image as a tree: the PPM header, then one part per block of
+ * HASH_LINES scanlines, the same digest whatever hashes the blocks
+ */
+void hash_image(uint32_t *pixels) {
+	int i, n, blocks = (yres + HASH_LINES - 1) / HASH_LINES;
+	char header[64];
+
+	n = sprintf(header, "P6\n%d %d\n255\n", xres, yres);
+	process_append_result(header, n);
+	process_result_parts(blocks);
+	struct hash_data *hd;
+
+	if(!(hd = malloc(thread_num * sizeof *hd))) {
+		perror("failed to allocate thread table");
+		exit(EXIT_FAILURE);
+	}
+	for(i=0; i<thread_num; i++) {
+		hd[i].first = i;
+		hd[i].pixels = pixels;
+		if(pthread_create(&hd[i].tid, 0, hash_func, &hd[i]) != 0) {
+			perror("failed to spawn thread");
+			exit(EXIT_FAILURE);
+		}
+	}
+	for(i=0; i<thread_num; i++) {
+		pthread_join(hd[i].tid, 0);
+	}
+	free(hd);
+}
+
+/* hashing thread, blocks first, first + thread_num, ... */
+void *hash_func(void *arg) {
+	struct hash_data *hd = arg;
+	int i, blocks = (yres + HASH_LINES - 1) / HASH_LINES;
+
+	for(i=hd->first; i<blocks; i+=thread_num) {
+		hash_block(hd->pixels, i);
+	}
+	return 0;
+}
+
 /* trace a ray throught the scene recursively (the recursion happens through
  * shade() to calculate reflection rays if necessary).
  */
@@ -452,6 +566,7 @@ struct vec3 trace(struct ray ray, int depth) {
 		col.x = col.y = col.z = 0.0;
 		return col;
 	}
+	ray_count++;
 
 	/* find the nearest intersection ... */
 	while(iter) {
@@ -497,6 +612,7 @@ struct vec3 shade(struct sphere *obj, struct spoint *sp, int depth) {
 		shadow_ray.dir = ldir;
 
 		/* shoot shadow rays to determine if we have a line of sight with the light */
+		shadow_count++;
 		while(iter) {
 			if(ray_sphere(iter, shadow_ray, 0)) {
 				in_shadow = 1;
@@ -636,6 +752,8 @@ struct vec3 jitter(int x, int y, int s) {
 int ray_sphere(const struct sphere *sph, struct ray ray, struct spoint *sp) {
 	double a, b, c, d, sqrt_d, t1, t2;
 
+	test_count++;
+
 	a = SQ(ray.dir.x) + SQ(ray.dir.y) + SQ(ray.dir.z);
 	b = 2.0 * ray.dir.x * (ray.orig.x - sph->pos.x) +
 				2.0 * ray.dir.y * (ray.orig.y - sph->pos.y) +
@@ -90,6 +90,7 @@ struct thread_data {
 	uint32_t *pixels;
 };
 
+void render_frame(void *fb);
 void render_scanline(int xsz, int ysz, int sl, uint32_t *fb, int samples);
 struct vec3 trace(struct ray ray, int depth);
 struct vec3 shade(struct sphere *obj, struct spoint *sp, int depth);
@@ -100,6 +101,9 @@ struct vec3 get_sample_pos(int x, int y, int sample);
 struct vec3 jitter(int x, int y, int s);
 int ray_sphere(const struct sphere *sph, struct ray ray, struct spoint *sp);
 void load_scene(FILE *fp);
+void count_rays(void);
+void hash_image(uint32_t *pixels);
+void hash_block(uint32_t *pixels, int block);
 unsigned long get_msec(void);
 
 #define MAX_LIGHTS		16				/* maximum number of lights */
@@ -139,11 +143,15 @@ struct vec3 lights[MAX_LIGHTS];
 int lnum = 0;
 struct camera cam;
 
+#define HASH_LINES	16	/* scanlines per part of the output digest */
 #define NRAN	1024
 #define MASK	(NRAN - 1)
 struct vec3 urand[NRAN];
 int irand[NRAN];
 
+/* rays traced, shadow rays and ray-sphere tests of this thread, see count_rays */
+static __thread unsigned long long ray_count, shadow_count, test_count;
+
 const char usage[] = {
 	"Usage: c-ray-mt [options]\n"
 	"  Reads a scene file from stdin, writes the image to stdout, and stats to stderr.\n\n"
@@ -153,6 +161,8 @@ const char usage[] = {
 	"  -i <file>  read from <file> instead of stdin\n"
 	"  -o <file>  write to <file> instead of stdout\n"
 	"  -n		  do not write output\n"
+	"  -R <runs>  render <runs> measured frames (default: 1)\n"
+	"  -W <runs>  render <runs> warmup frames first (default: 0)\n"
 	"  -h         this help screen\n\n"
 };
 
@@ -164,11 +174,10 @@ int main(int argc, char **argv, char **envp) {
     process_mode(SEQ);
     process_args(argc, argv);
 
-	int i, noout = 0;
+	int i, noout = 0, runs = 1, warmup = 0;
 	unsigned long rend_time, start_time;
 	uint32_t *pixels;
 	FILE *infile = stdin, *outfile = stdout;
-	char * tgt_file;
 
 	for(i=1; i<argc; i++) {
 		if(argv[i][0] == '-' && argv[i][2] == 0) {
@@ -193,7 +202,6 @@ int main(int argc, char **argv, char **envp) {
 				break;
 
 			case 'o':
-				tgt_file = argv[i+1];
 				if(!(outfile = fopen(argv[++i], "wb"))) {
 					fprintf(stderr, "failed to open output file %s: %s\n", argv[i], strerror(errno));
 					return EXIT_FAILURE;
@@ -204,6 +212,21 @@ int main(int argc, char **argv, char **envp) {
 				noout = 1;
 				break;
 
+			case 'R':
+				if(!isdigit(argv[++i][0]) || !(runs = atoi(argv[i]))) {
+					fputs("-R must be followed by a positive number (measured frames)\n", stderr);
+					return EXIT_FAILURE;
+				}
+				break;
+
+			case 'W':
+				if(!isdigit(argv[++i][0])) {
+					fputs("-W must be followed by a number (warmup frames)\n", stderr);
+					return EXIT_FAILURE;
+				}
+				warmup = atoi(argv[i]);
+				break;
+
 			case 'r':
 				if(!isdigit(argv[++i][0])) {
 					fputs("-r must be followed by a number (rays per pixel)\n", stderr);
@@ -232,20 +255,24 @@ int main(int argc, char **argv, char **envp) {
 		perror("pixel buffer allocation failed");
 		return EXIT_FAILURE;
 	}
+	process_phase(PHASE_LOAD);
+	bench_region_begin("load_scene");
 	load_scene(infile);
+	bench_region_end();
 
 	/* initialize the random number tables for the jitter */
 	for(i=0; i<NRAN; i++) urand[i].x = (double)rand() / RAND_MAX - 0.5;
 	for(i=0; i<NRAN; i++) urand[i].y = (double)rand() / RAND_MAX - 0.5;
 	for(i=0; i<NRAN; i++) irand[i] = (int)(NRAN * ((double)rand() / RAND_MAX));
 
-	process_start_measure();
-	for(i=0; i<yres; i++) {
-		render_scanline(xres, yres, i, (uint32_t*)((void*)pixels + i*xres*sizeof(uint32_t)), rays_per_pixel);
-	}
-	process_stop_measure();
+	process_phase(PHASE_COMPUTE);
+	bench_region_begin("render");
+	process_repeat(warmup, runs, render_frame, pixels);
+	bench_region_end();
 
+	process_phase(PHASE_OUTPUT);
 	if(!noout) {
+	bench_region_begin("output");
 	/* output the image */
 		fprintf(outfile, "P6\n%d %d\n255\n", xres, yres);
 		for(i=0; i<xres * yres; i++) {
@@ -254,19 +281,13 @@ int main(int argc, char **argv, char **envp) {
 			fputc((pixels[i] >> BSHIFT) & 0xff, outfile);
 		}
 		fflush(outfile);
-		fclose(outfile);
-		FILE * out_file = fopen(tgt_file, "rb");
-		char out_bytes[128];
-		int out_size;
-		out_size = fread(out_bytes, 1, 128, out_file);
-		while(out_size > 0) {
-			process_append_result(out_bytes, out_size);
-			out_size = fread(out_bytes, 1, 128, out_file);
-		}
-		fclose(out_file);
+		if(outfile != stdout) fclose(outfile);
+	bench_region_end();
 	}
+	process_phase(PHASE_VERIFY);
+	hash_image(pixels);
+	process_phase_end();
 	if(infile != stdin) fclose(infile);
-	/*if(outfile != stdout) fclose(outfile);*/
 	struct sphere *walker = obj_list;
 	while(walker) {
 		struct sphere *tmp = walker;
@@ -278,6 +299,15 @@ int main(int argc, char **argv, char **envp) {
 	return 0;
 }
 
+/* render a whole frame, the unit measured by process_repeat */
+void render_frame(void *fb) {
+	int i;
+	for(i=0; i<yres; i++) {
+		render_scanline(xres, yres, i, (uint32_t*)fb + i*xres, rays_per_pixel);
+	}
+	count_rays();
+}
+
 /* render a frame of xsz/ysz dimensions into the provided framebuffer */
 void render_scanline(int xsz, int ysz, int sl, uint32_t *fb, int samples) {
 	int i, s;
@@ -304,6 +334,50 @@ void render_scanline(int xsz, int ysz, int sl, uint32_t *fb, int samples) {
 	}
 }
 
+/* hand the counts of the calling thread over to the bench API, once it is done rendering */
+void count_rays(void) {
+	task_add_count("rays", ray_count + shadow_count);
+	task_add_count("shadow_rays", shadow_count);
+	task_add_count("intersections", test_count);
+	ray_count = shadow_count = test_count = 0;
+}
+
+/* hash one block of HASH_LINES scanlines, as their PPM bytes, into its own part */
+void hash_block(uint32_t *pixels, int block) {
+	int i, j;
+	unsigned char *row;
+
+	if(!(row = malloc(xres * 3))) {
+		perror("row buffer allocation failed");
+		exit(EXIT_FAILURE);
+	}
+	for(j=block * HASH_LINES; j<yres && j<(block + 1) * HASH_LINES; j++) {
+		uint32_t *line = pixels + j * xres;
+		for(i=0; i<xres; i++) {
+			row[i * 3] = (line[i] >> RSHIFT) & 0xff;
+			row[i * 3 + 1] = (line[i] >> GSHIFT) & 0xff;
+			row[i * 3 + 2] = (line[i] >> BSHIFT) & 0xff;
+		}
+		process_append_part(block, (char *)row, xres * 3);
+	}
+	free(row);
+}
+
+/* digest the image as a tree: the PPM header, then one part per block of
+ * HASH_LINES scanlines, the same digest whatever hashes the blocks
+ */
+void hash_image(uint32_t *pixels) {
+	int i, n, blocks = (yres + HASH_LINES - 1) / HASH_LINES;
+	char header[64];
+
+	n = sprintf(header, "P6\n%d %d\n255\n", xres, yres);
+	process_append_result(header, n);
+	process_result_parts(blocks);
+	for(i=0; i<blocks; i++) {
+		hash_block(pixels, i);
+	}
+}
+
 /* trace a ray throught the scene recursively (the recursion happens through
  * shade() to calculate reflection rays if necessary).
  */
@@ -318,6 +392,7 @@ struct vec3 trace(struct ray ray, int depth) {
 		col.x = col.y = col.z = 0.0;
 		return col;
 	}
+	ray_count++;
 
 	/* find the nearest intersection ... */
 	while(iter) {
@@ -363,6 +438,7 @@ struct vec3 shade(struct sphere *obj, struct spoint *sp, int depth) {
 		shadow_ray.dir = ldir;
 
 		/* shoot shadow rays to determine if we have a line of sight with the light */
+		shadow_count++;
 		while(iter) {
 			if(ray_sphere(iter, shadow_ray, 0)) {
 				in_shadow = 1;
@@ -502,6 +578,8 @@ struct vec3 jitter(int x, int y, int s) {
 int ray_sphere(const struct sphere *sph, struct ray ray, struct spoint *sp) {
 	double a, b, c, d, sqrt_d, t1, t2;
 
+	test_count++;
+
 	a = SQ(ray.dir.x) + SQ(ray.dir.y) + SQ(ray.dir.z);
 	b = 2.0 * ray.dir.x * (ray.orig.x - sph->pos.x) +
 				2.0 * ray.dir.y * (ray.orig.y - sph->pos.y) +